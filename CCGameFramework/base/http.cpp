@@ -0,0 +1,310 @@
+﻿#include "stdafx.h"
+#include "http.h"
+#include <event2/event.h>
+#include <base/utils.h>
+
+http_engine& http_engine::singleton()
+{
+    static http_engine engine;
+    return engine;
+}
+
+void http_engine::start(event_base* base)
+{
+    if (running)
+        return;
+    this->base = base;
+    evutil_socketpair(AF_INET, SOCK_STREAM, 0, wake);
+    evutil_socketpair(AF_INET, SOCK_STREAM, 0, notify);
+    for (auto fd : { wake[0], wake[1], notify[0], notify[1] })
+        evutil_make_socket_nonblocking(fd);
+    notify_event = event_new(base, notify[0], EV_READ | EV_PERSIST, &http_engine::on_notify, this);
+    event_add(notify_event, nullptr);
+    multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)HTTP_MAX_ACTIVE);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)HTTP_MAX_HOST_CONNECTIONS);
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)HTTP_CONNECTION_CACHE);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = true;
+        if (!completed.empty()) // 启动前提交的请求已失败，交给主线程回调
+            send(notify[1], "x", 1, 0);
+    }
+    worker = std::thread(&http_engine::run, this);
+#if HTTP_BENCH
+    bench();
+#endif
+}
+
+void http_engine::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running)
+            return;
+        running = false;
+    }
+    send(wake[1], "x", 1, 0);
+    worker.join();
+    for (auto& t : transfers)
+    {
+        curl_multi_remove_handle(multi, t.first);
+        curl_easy_cleanup(t.first);
+    }
+    transfers.clear();
+    for (auto& curl : idle)
+        curl_easy_cleanup(curl);
+    idle.clear();
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+    event_free(notify_event);
+    notify_event = nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    pending.clear();
+    completed.clear();
+    for (auto fd : { wake[0], wake[1], notify[0], notify[1] })
+        evutil_closesocket(fd);
+    wake[0] = wake[1] = notify[0] = notify[1] = -1;
+}
+
+void http_engine::request(const http_request_t& req, http_callback done)
+{
+    std::unique_ptr<job_t> job(new job_t());
+    job->req = req;
+    job->done = std::move(done);
+    job->submit = std::chrono::high_resolution_clock::now();
+    // 持锁发送，stop()在同一把锁下关闭套接字
+    std::lock_guard<std::mutex> guard(lock);
+    if (running)
+    {
+        pending.push_back(std::move(job));
+        send(wake[1], "x", 1, 0);
+    }
+    else
+    {
+        // 引擎未运行时以失败结束，回调仍由主线程在dispatch中执行
+        // 启动前提交的在start()时通知，停止后事件循环已退出，不再回调
+        completed.push_back(std::move(job));
+        if (notify[1] != -1)
+            send(notify[1], "x", 1, 0);
+    }
+}
+
+void http_engine::run()
+{
+    while (true)
+    {
+        std::vector<std::unique_ptr<job_t>> jobs;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!running)
+                break;
+            while (transfers.size() + jobs.size() < HTTP_MAX_ACTIVE && !pending.empty())
+            {
+                jobs.push_back(std::move(pending.front()));
+                pending.pop_front();
+            }
+        }
+        for (auto& job : jobs)
+            begin(std::move(job));
+        int still;
+        curl_multi_perform(multi, &still);
+        CURLMsg* msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left)) != nullptr)
+        {
+            if (msg->msg == CURLMSG_DONE)
+                finish(msg->easy_handle, msg->data.result);
+        }
+        // 等待网络事件或新请求，超时由curl按内部定时器缩短
+        curl_waitfd fd;
+        fd.fd = (curl_socket_t)wake[0];
+        fd.events = CURL_WAIT_POLLIN;
+        fd.revents = 0;
+        curl_multi_wait(multi, &fd, 1, 1000, nullptr);
+        if (fd.revents)
+        {
+            char buf[64];
+            while (recv(wake[0], buf, sizeof(buf), 0) > 0);
+        }
+    }
+}
+
+void http_engine::begin(std::unique_ptr<job_t> job)
+{
+    CURL* curl;
+    if (!idle.empty())
+    {
+        curl = idle.back();
+        idle.pop_back();
+        curl_easy_reset(curl);
+    }
+    else
+    {
+        curl = curl_easy_init();
+    }
+    if (!curl)
+    {
+        complete(std::move(job));
+        return;
+    }
+    auto& req = job->req;
+    job->curl = curl;
+    job->resp.body.reserve(HTTP_BUFFER_SIZE);
+    curl_easy_setopt(curl, CURLOPT_URL, req.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; WOW64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/50.0.2661.102 Safari/537.36");
+    if (req.post)
+    {
+        req.postfield = encode(curl, req.postfield);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req.postfield.c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 60L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, job.get());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &http_engine::write);
+    curl_multi_add_handle(multi, curl);
+    transfers.insert(std::make_pair(curl, std::move(job)));
+}
+
+void http_engine::finish(CURL* curl, CURLcode result)
+{
+    auto f = transfers.find(curl);
+    if (f == transfers.end())
+        return;
+    auto job = std::move(f->second);
+    transfers.erase(f);
+    curl_multi_remove_handle(multi, curl);
+    auto& resp = job->resp;
+    resp.ok = result == CURLE_OK;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &resp.code);
+    char* content_type = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
+    if (content_type)
+        resp.content_type = content_type;
+    idle.push_back(curl); // 连接由multi缓存，句柄留作下次复用
+    complete(std::move(job));
+}
+
+void http_engine::complete(std::unique_ptr<job_t> job)
+{
+    job->resp.latency = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - job->submit).count();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        completed.push_back(std::move(job));
+    }
+    send(notify[1], "x", 1, 0);
+}
+
+void http_engine::on_notify(evutil_socket_t fd, short what, void* arg)
+{
+    char buf[64];
+    while (recv(fd, buf, sizeof(buf), 0) > 0);
+    ((http_engine*)arg)->dispatch();
+}
+
+void http_engine::dispatch()
+{
+    std::vector<std::unique_ptr<job_t>> jobs;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.swap(completed);
+    }
+    for (auto& job : jobs)
+    {
+        if (job->done)
+            job->done(job->resp);
+    }
+}
+
+size_t http_engine::write(char* data, size_t size, size_t nmemb, void* arg)
+{
+    auto job = (job_t*)arg;
+    auto sizes = size * nmemb;
+    auto& body = job->resp.body;
+    if (body.empty())
+    {
+        double length = -1;
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+        if (length > (double)body.capacity())
+            body.reserve((size_t)min(length, (double)HTTP_RESERVE_MAX));
+    }
+    body.insert(body.end(), data, data + sizes);
+    return sizes;
+}
+
+static std::string local_to_utf8(const std::string& str)
+{
+    auto wlen = MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, nullptr, 0);
+    std::wstring wstr(wlen, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, &wstr[0], wlen);
+    auto len = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    std::string s(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &s[0], len, nullptr, nullptr);
+    s.resize(len > 0 ? len - 1 : 0);
+    return s;
+}
+
+std::string http_engine::encode(CURL* curl, const std::string& postfield)
+{
+    std::string s;
+    for (auto& p : std::split(postfield, '&'))
+    {
+        auto p2 = std::split(p, '=');
+        if (p2.size() == 2)
+        {
+            s += p2[0];
+            s += '=';
+            auto utf8 = local_to_utf8(p2[1]);
+            auto pf = curl_easy_escape(curl, utf8.c_str(), (int)utf8.length());
+            s += pf;
+            curl_free(pf);
+            s += '&';
+        }
+    }
+    if (!s.empty() && s.back() == '&')
+        s.pop_back();
+    return s;
+}
+
+#if HTTP_BENCH
+void http_engine::bench()
+{
+    struct bench_t
+    {
+        std::chrono::high_resolution_clock::time_point start;
+        std::vector<double> latency;
+        size_t bytes{ 0 };
+        int failed{ 0 };
+    };
+    auto b = std::make_shared<bench_t>();
+    b->start = std::chrono::high_resolution_clock::now();
+    for (auto i = 0; i < HTTP_BENCH_COUNT; ++i)
+    {
+        http_request_t req;
+        req.url = HTTP_BENCH_URL;
+        request(req, [b](http_response_t& resp) {
+            b->latency.push_back(resp.latency);
+            if (resp.ok)
+                b->bytes += resp.body.size();
+            else
+                b->failed++;
+            if (b->latency.size() < HTTP_BENCH_COUNT)
+                return;
+            auto total = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - b->start).count();
+            std::sort(b->latency.begin(), b->latency.end());
+            ATLTRACE("[SYSTEM] HTTP | Bench: %d requests, %d failed, %.2f ms, %.1f req/s, %.1f KB/s, p50 %.2f ms, p99 %.2f ms\n",
+                HTTP_BENCH_COUNT, b->failed, total,
+                HTTP_BENCH_COUNT * 1000.0 / total, b->bytes / total * 1000.0 / 1024.0,
+                b->latency[b->latency.size() / 2], b->latency[b->latency.size() * 99 / 100]);
+        });
+    }
+}
+#endif
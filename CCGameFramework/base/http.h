@@ -0,0 +1,99 @@
+﻿#ifndef BASE_HTTP_H
+#define BASE_HTTP_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <curl/curl.h>
+#include <event2/util.h>
+
+#define HTTP_MAX_ACTIVE 8 // 同时进行的请求数，超出的排队
+#define HTTP_MAX_HOST_CONNECTIONS 4
+#define HTTP_CONNECTION_CACHE 16 // 保持的空闲连接数
+#define HTTP_BUFFER_SIZE (64 * 1024) // 响应缓冲预分配，有Content-Length时按其分配
+#define HTTP_RESERVE_MAX (16 * HTTP_BUFFER_SIZE) // 按Content-Length预分配的上限，超出部分按需增长
+#define HTTP_BENCH 0 // 启动后对本机服务压测，如 python -m http.server 8000
+#define HTTP_BENCH_URL "http://127.0.0.1:8000/"
+#define HTTP_BENCH_COUNT 200
+
+struct event_base;
+struct event;
+
+struct http_request_t
+{
+    std::string url;
+    bool post{ false };
+    std::string postfield; // a=b&c=d，值为本地编码，发送前转为UTF-8并转义
+};
+
+struct http_response_t
+{
+    bool ok{ false };
+    long code{ 0 };
+    std::string content_type;
+    std::vector<unsigned char> body;
+    double latency{ 0 }; // 提交到完成，毫秒
+};
+
+using http_callback = std::function<void(http_response_t&)>;
+
+// 共享的异步HTTP引擎：单线程驱动curl_multi，复用连接
+// request可在任意线程调用，回调在主线程的event_base中执行
+class http_engine
+{
+public:
+    static http_engine& singleton();
+
+    http_engine(const http_engine&) = delete;
+    http_engine& operator=(const http_engine&) = delete;
+
+    void start(event_base* base);
+    void stop();
+    void request(const http_request_t& req, http_callback done);
+
+private:
+    http_engine() = default;
+
+    struct job_t
+    {
+        http_request_t req;
+        http_callback done;
+        http_response_t resp;
+        std::chrono::high_resolution_clock::time_point submit;
+        CURL* curl{ nullptr };
+    };
+
+    void run();
+    void begin(std::unique_ptr<job_t> job);
+    void finish(CURL* curl, CURLcode result);
+    void complete(std::unique_ptr<job_t> job);
+    void dispatch();
+    static std::string encode(CURL* curl, const std::string& postfield);
+    static size_t write(char* data, size_t size, size_t nmemb, void* arg);
+    static void on_notify(evutil_socket_t fd, short what, void* arg);
+#if HTTP_BENCH
+    void bench();
+#endif
+
+    event_base* base{ nullptr };
+    event* notify_event{ nullptr };
+    evutil_socket_t wake[2]{ -1, -1 }; // 唤醒工作线程
+    evutil_socket_t notify[2]{ -1, -1 }; // 通知主线程取回结果
+    CURLM* multi{ nullptr };
+    std::thread worker;
+    std::mutex lock;
+    bool running{ false };
+    std::deque<std::unique_ptr<job_t>> pending;
+    std::vector<std::unique_ptr<job_t>> completed;
+    // 以下只在工作线程访问
+    std::unordered_map<CURL*, std::unique_ptr<job_t>> transfers;
+    std::vector<CURL*> idle; // 可复用的easy句柄
+};
+
+#endif
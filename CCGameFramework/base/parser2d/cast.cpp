@@ -29,13 +29,9 @@ namespace clib {
     }
 
     ast_node* cast::new_node(ast_t type) {
-        if (nodes.available() < 64) {
-            error("'nodes' out of memory");
-        }
-        auto node = nodes.alloc<ast_node>();
-        if (!node)
-            error("'nodes' out of memory");
+        auto node = type == ast_collection ? colls.alloc<ast_node>() : nodes.alloc<ast_node>();
         memset(node, 0, sizeof(ast_node));
+        nodes_created++;
         node->flag = type;
         return node;
     }
@@ -124,7 +120,6 @@ namespace clib {
                 } while (i != f);
             }
         }
-        nodes.free(node);
     }
 
     void cast::to(ast_to_t type) {
@@ -145,9 +140,6 @@ namespace clib {
     }
 
     void cast::set_str(ast_node * node, const string_t & str) {
-        if (strings.available() < 64) {
-            error("'strings' out of memory");
-        }
         auto len = str.length();
         auto s = strings.alloc_array<char>(len + 1);
         memcpy(s, str.c_str(), len);
@@ -177,12 +169,30 @@ namespace clib {
         return ss.str();
     }
 
+    cast::mark_t cast::mark() const {
+        return colls.mark();
+    }
+
+    void cast::rewind(const mark_t& m) {
+        colls.rewind(m);
+    }
+
     void cast::reset() {
         nodes.clear();
+        colls.clear();
         strings.clear();
+        nodes_created = 0;
         init();
     }
 
+    int cast::node_count() const {
+        return nodes_created;
+    }
+
+    size_t cast::used() const {
+        return nodes.used() + colls.used() + strings.used();
+    }
+
     template<class T>
     static void ast_recursion(ast_node * node, int level, std::ostream & os, T f) {
         if (node == nullptr)
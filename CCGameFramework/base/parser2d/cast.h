@@ -9,8 +9,8 @@
 #include "types.h"
 #include "memory.h"
 
-#define AST_NODE_MEM (256 * 1024)
-#define AST_STR_MEM (16 * 1024)
+#define AST_NODE_CHUNK (64 * 1024)
+#define AST_STR_CHUNK (16 * 1024)
 
 namespace clib {
 
@@ -120,17 +120,26 @@ namespace clib {
         static ast_node* index(ast_node* node, int index);
         static ast_node* index(ast_node* node, const string_t& index);
 
+        using mark_t = memory_arena<AST_NODE_CHUNK>::mark_t;
+        mark_t mark() const;
+        void rewind(const mark_t& m);
+
         void reset();
+
+        int node_count() const;
+        size_t used() const;
     private:
         void init();
 
         void error(const string_t&);
 
     private:
-        memory_pool<AST_NODE_MEM> nodes; // 全局AST结点内存管理
-        memory_pool<AST_STR_MEM> strings; // 全局字符串管理
+        memory_arena<AST_NODE_CHUNK> nodes; // 终结符及根结点，不回退
+        memory_arena<AST_NODE_CHUNK> colls; // 非终结符结点，回溯时回退
+        memory_arena<AST_STR_CHUNK> strings; // 全局字符串管理
         ast_node* root{ nullptr }; // 根结点
         ast_node* current{ nullptr }; // 当前结点
+        int nodes_created{ 0 }; // 含回溯时丢弃的结点
     };
 }
 
@@ -0,0 +1,429 @@
+﻿//
+// Project: CMiniLang
+// Author: bajdcc
+//
+
+#include "stdafx.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <chrono>
+#include "ccompiler.h"
+#include "cexception.h"
+
+#define LOG_AST 0
+
+namespace clib {
+
+    static uint64_t cache_hash(const string_t & code, uint64_t h = 14695981039346656037ULL) { // FNV-1a，跨进程稳定
+        for (auto& c : code) {
+            h ^= (byte)c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // 目标单元由自身及所依赖单元的源码共同决定
+    static uint64_t unit_hash(const csource_t & src, const string_t & unit) {
+        auto& deps = src.unit_dep.at(unit);
+        auto h = 14695981039346656037ULL;
+        for (auto& u : src.units) {
+            if (u == unit || deps.find(u) != deps.end())
+                h = cache_hash(src.unit_code.at(u), h);
+        }
+        return h;
+    }
+
+    void ccompile_stat_t::add(const ccompile_stat_t & s) {
+        include += s.include;
+        lexer += s.lexer;
+        parser += s.parser;
+        gen += s.gen;
+        link += s.link;
+        total += s.total;
+        units += s.units;
+        units_cached += s.units_cached;
+        tokens += s.tokens;
+        backtracks += s.backtracks;
+        ast_nodes += s.ast_nodes;
+        ast_bytes += s.ast_bytes;
+        symbols += s.symbols;
+        symbol_bytes += s.symbol_bytes;
+        instructions += s.instructions;
+    }
+
+    using stat_clock = std::chrono::steady_clock;
+
+    static double elapsed(const stat_clock::time_point & start) {
+        return std::chrono::duration<double, std::milli>(stat_clock::now() - start).count();
+    }
+
+    // 分析并生成一段源码，各阶段计入统计
+    static void compile_code(cparser & p, cgen & gen, const string_t & code, ccompile_stat_t & stat) {
+        auto start = stat_clock::now();
+        auto root = p.parse(code, &gen);
+        auto parse_time = elapsed(start);
+        const auto& ps = p.get_stat();
+        stat.lexer += ps.lexer_time * 1000;
+        stat.parser += parse_time - ps.lexer_time * 1000;
+        stat.tokens += ps.tokens;
+        stat.backtracks += ps.backtracks;
+        stat.ast_nodes += ps.ast_nodes;
+        stat.ast_bytes += ps.ast_bytes;
+#if LOG_AST
+        cast::print(root, 0, std::cout);
+#endif
+        start = stat_clock::now();
+        gen.gen(root);
+        stat.gen += elapsed(start);
+        auto gs = gen.get_stat();
+        stat.instructions += gs.instructions;
+        stat.symbols += gs.symbols;
+        stat.symbol_bytes += gs.symbol_bytes;
+        stat.units++;
+    }
+
+    ccompiler::ccompiler(int workers, bool disk_cache) : disk_cache(disk_cache) {
+        if (workers <= 0)
+            workers = (int)std::thread::hardware_concurrency();
+        if (workers <= 0)
+            workers = 1;
+        for (auto i = 0; i < workers; ++i) {
+            threads.emplace_back(&ccompiler::worker, this);
+        }
+    }
+
+    ccompiler::~ccompiler() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopped = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    void ccompiler::submit(const csource_t & src) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto& r = results[src.path];
+            if (r.state != cs_none)
+                return;
+            r.state = cs_pending;
+            r.version = ++version;
+            jobs.push_back(job_t{ src, r.version });
+        }
+        cv.notify_one();
+    }
+
+    compile_state_t ccompiler::query(const string_t & path, std::vector<byte> & file, int & fail_errno) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto f = results.find(path);
+        if (f == results.end())
+            return cs_none;
+        if (f->second.state == cs_done)
+            file = f->second.file;
+        else if (f->second.state == cs_failed)
+            fail_errno = f->second.fail_errno;
+        return f->second.state;
+    }
+
+    std::vector<string_t> ccompiler::invalidate(const std::unordered_set<string_t> & paths) {
+        std::vector<string_t> programs; // 曾提交过的程序，需要重新编译
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto& path : paths) {
+                auto f = results.find(path);
+                if (f != results.end()) {
+                    programs.push_back(path);
+                    results.erase(f);
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx_obj);
+            for (auto& path : paths) {
+                cache_obj.erase(path);
+            }
+        }
+        return programs;
+    }
+
+    std::vector<ccompile_stat_t> ccompiler::get_stats() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return std::vector<ccompile_stat_t>(history.begin(), history.end());
+    }
+
+    ccompile_stat_t ccompiler::get_total() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return total;
+    }
+
+    static void report_line(std::ostream & os, const string_t & name, const ccompile_stat_t & s, char mark) {
+        char sz[256];
+        auto path = name.length() > 13 ? name.substr(name.length() - 13) : name;
+        snprintf(sz, sizeof(sz), "%c%-13s %6.1f %6.1f %6.1f %7.1f %6.1f %6.1f %7d %5d %6d",
+            mark, path.c_str(), s.total, s.include, s.lexer, s.parser, s.gen, s.link,
+            s.tokens, s.backtracks, s.instructions);
+        os << sz << std::endl;
+    }
+
+    // 最近的编译记录及累计值，供/sys/compiler读取
+    string_t ccompiler::report() const {
+        auto stats = get_stats();
+        auto sum = get_total();
+        std::stringstream ss;
+        ss << "\033FFFA0A0A0\033 [PATH]         [MS]  [INC]  [LEX] [PARSE]  [GEN] [LINK] [TOKEN]  [BT]  [INS]\033S4\033" << std::endl;
+        for (auto& s : stats) {
+            report_line(ss, s.path, s, s.failed ? '!' : s.disk_cached ? '*' : ' ');
+        }
+        report_line(ss, "TOTAL", sum, ' ');
+        char sz[256];
+        snprintf(sz, sizeof(sz), " Units: %d compiled, %d reused | AST: %d nodes, %d KB | Symbols: %d, %d KB",
+            sum.units, sum.units_cached, sum.ast_nodes, (int)(sum.ast_bytes / 1024),
+            sum.symbols, (int)(sum.symbol_bytes / 1024));
+        ss << sz << std::endl;
+        return ss.str();
+    }
+
+    void ccompiler::worker() {
+        cparser p;
+        cgen gen;
+        for (;;) {
+            job_t job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return stopped || !jobs.empty(); });
+                if (stopped)
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            std::vector<byte> file;
+            ccompile_stat_t stat;
+            auto fail_errno = build(p, gen, job.src, file, stat);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                total.add(stat);
+                history.push_back(stat);
+                if (history.size() > COMPILER_HISTORY)
+                    history.pop_front();
+                auto f = results.find(job.src.path);
+                if (f == results.end() || f->second.version != job.version)
+                    continue; // 编译期间源码已失效
+                auto& r = f->second;
+                if (fail_errno == 0) {
+                    r.state = cs_done;
+                    r.file = std::move(file);
+                }
+                else {
+                    r.state = cs_failed;
+                    r.fail_errno = fail_errno;
+                }
+            }
+        }
+    }
+
+    int ccompiler::build(cparser & p, cgen & gen, const csource_t & src, std::vector<byte> & file, ccompile_stat_t & stat) {
+        auto start = stat_clock::now();
+        stat.path = src.path;
+        stat.include = src.include_time;
+        try {
+            if (disk_cache && load_cache(src.code, file)) {
+                stat.disk_cached = true;
+            }
+            else {
+#if COMPILER_SEPARATE
+                if (!link_units(p, gen, src, file, stat))
+#endif
+                { // 整体编译：单元依赖未在#include中声明时退回此处
+                    stat.fallback = true;
+                    gen.reset();
+                    compile_code(p, gen, src.code, stat);
+                    file = gen.file();
+                    p.clear_ast();
+                    gen.reset();
+                }
+                if (disk_cache)
+                    save_cache(src.code, file);
+            }
+            stat.total = elapsed(start);
+            ATLTRACE("[SYSTEM] COMP | Done: %s, %d bytes, %.2f ms\n", src.path.c_str(), (int)file.size(), stat.total);
+            return 0;
+        }
+        catch (const cexception & e) {
+            gen.reset();
+            stat.total = elapsed(start);
+            stat.failed = true;
+            ATLTRACE("[SYSTEM] ERR  | PATH: %s, %s\n", src.path.c_str(), e.message().c_str());
+            return -2;
+        }
+        catch (const std::exception & e) { // out_of_range、bad_alloc等
+            gen.reset();
+            stat.total = elapsed(start);
+            stat.failed = true;
+            ATLTRACE("[SYSTEM] ERR  | PATH: %s, %s\n", src.path.c_str(), e.what());
+            return -2;
+        }
+    }
+
+    bool ccompiler::link_units(cparser & p, cgen & gen, const csource_t & src, std::vector<byte> & file, ccompile_stat_t & stat) {
+        std::vector<cobj_t::ref> objs;
+        string_t unit;
+        try {
+            for (auto& u : src.units) { // 按拓扑序编译，依赖单元已在前面
+                auto hash = unit_hash(src, u);
+                {
+                    std::lock_guard<std::mutex> lock(mtx_obj);
+                    auto f = cache_obj.find(u);
+                    if (f != cache_obj.end() && f->second.hash == hash) {
+                        if (!f->second.obj)
+                            return false; // 该单元无法单独编译
+                        f->second.tick = ++obj_tick;
+                        objs.push_back(f->second.obj);
+                        stat.units_cached++;
+                        continue;
+                    }
+                }
+                unit = u;
+                gen.reset();
+                auto& deps = src.unit_dep.at(u);
+                for (auto& obj : objs) {
+                    if (deps.find(obj->path) != deps.end())
+                        gen.import(obj);
+                }
+                compile_code(p, gen, src.unit_code.at(u), stat);
+                auto obj = gen.object(u);
+                p.clear_ast();
+                {
+                    // 其他线程可能同时编译同一单元，结果相同，后写入者覆盖
+                    std::lock_guard<std::mutex> lock(mtx_obj);
+                    cache_put(u, hash, obj);
+                }
+                objs.push_back(obj);
+                unit.clear();
+            }
+            auto start = stat_clock::now();
+            file = gen.link(objs);
+            stat.link += elapsed(start);
+            gen.reset();
+            return true;
+        }
+        catch (const cexception & e) {
+            gen.reset();
+            if (!unit.empty()) {
+                std::lock_guard<std::mutex> lock(mtx_obj);
+                cache_put(unit, unit_hash(src, unit), nullptr);
+            }
+            ATLTRACE("[SYSTEM] ERR  | LINK: %s, %s\n", src.path.c_str(), e.message().c_str());
+            return false;
+        }
+        catch (const std::exception & e) {
+            gen.reset();
+            if (!unit.empty()) {
+                std::lock_guard<std::mutex> lock(mtx_obj);
+                cache_put(unit, unit_hash(src, unit), nullptr);
+            }
+            ATLTRACE("[SYSTEM] ERR  | LINK: %s, %s\n", src.path.c_str(), e.what());
+            return false;
+        }
+    }
+
+    // 调用方持有mtx_obj，超出总量时淘汰最久未用的单元，下次用到时重新编译
+    void ccompiler::cache_put(const string_t & unit, uint64_t hash, const cobj_t::ref & obj) {
+        cache_obj[unit] = obj_t{ hash, obj, ++obj_tick };
+        for (;;) {
+            size_t total = 0;
+            auto victim = cache_obj.end();
+            for (auto i = cache_obj.begin(); i != cache_obj.end(); ++i) {
+                if (!i->second.obj)
+                    continue;
+                total += i->second.obj->retained;
+                if (i->first != unit && (victim == cache_obj.end() || i->second.tick < victim->second.tick))
+                    victim = i;
+            }
+            if (total <= COMPILER_OBJ_CACHE_MAX || victim == cache_obj.end())
+                break;
+            cache_obj.erase(victim);
+        }
+    }
+
+    struct cache_header_t {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        uint32_t code_len;
+        uint32_t file_len;
+    };
+
+    string_t ccompiler::cache_file(const string_t & code) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llX.pe", (unsigned long long)(cache_hash(code) ^ CGEN_CONFIG));
+        return string_t(COMPILER_CACHE_DIR) + name;
+    }
+
+    bool ccompiler::load_cache(const string_t & code, std::vector<byte> & file) {
+        if (string_t(COMPILER_CACHE_DIR).empty())
+            return false;
+        std::ifstream f(cache_file(code), std::ios::binary);
+        if (!f)
+            return false;
+        cache_header_t header;
+        if (!f.read((char*)& header, sizeof(header)))
+            return false;
+        if (std::memcmp(header.magic, COMPILER_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != CGEN_CONFIG ||
+            header.hash != cache_hash(code) ||
+            header.code_len != code.size())
+            return false;
+        // 长度与实际文件大小不符时不信任头部，避免按损坏的file_len分配
+        f.seekg(0, std::ios::end);
+        if ((uint64_t)f.tellg() != sizeof(header) + (uint64_t)header.code_len + header.file_len)
+            return false;
+        f.seekg(sizeof(header), std::ios::beg);
+        // 哈希只用于定位，命中时仍比较完整源码
+        string_t src(header.code_len, '\0');
+        if (!f.read(&src[0], header.code_len) || src != code)
+            return false;
+        file.resize(header.file_len);
+        if (!f.read((char*)file.data(), header.file_len)) {
+            file.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void ccompiler::save_cache(const string_t & code, const std::vector<byte> & file) {
+        if (string_t(COMPILER_CACHE_DIR).empty())
+            return;
+        CreateDirectoryA(COMPILER_CACHE_DIR, NULL);
+        auto path = cache_file(code);
+        // 临时文件名带线程号，多个线程同时写同一缓存时互不干扰
+        char tid[32];
+        snprintf(tid, sizeof(tid), ".%lu.tmp", (unsigned long)GetCurrentThreadId());
+        auto tmp = path + tid;
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f)
+                return;
+            cache_header_t header;
+            std::memcpy(header.magic, COMPILER_CACHE_MAGIC, sizeof(header.magic));
+            header.version = CGEN_CONFIG;
+            header.hash = cache_hash(code);
+            header.code_len = (uint32_t)code.size();
+            header.file_len = (uint32_t)file.size();
+            f.write((const char*)& header, sizeof(header));
+            f.write(code.data(), code.size());
+            f.write((const char*)file.data(), file.size());
+            if (!f)
+                return;
+        }
+        // 先写临时文件再替换，避免其他实例读到半个文件
+        if (!MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            DeleteFileA(tmp.c_str());
+            ATLTRACE("[SYSTEM] ERR  | Cache: save failed %s\n", path.c_str());
+        }
+    }
+}
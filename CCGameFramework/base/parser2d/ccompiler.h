@@ -0,0 +1,129 @@
+﻿//
+// Project: CMiniLang
+// Author: bajdcc
+//
+#ifndef CMINILANG_COMPILER_H
+#define CMINILANG_COMPILER_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include "types.h"
+#include "cparser.h"
+#include "cgen.h"
+
+#define COMPILER_WORKERS 0 // 编译线程数，0为硬件线程数
+#define COMPILER_CACHE_DIR "./script/cache" // 编译缓存目录，为空时禁用
+#define COMPILER_CACHE_MAGIC "ccpc"
+#define COMPILER_SEPARATE 1 // 按文件编译为目标单元再链接
+#define COMPILER_HISTORY 32 // 保留最近若干次编译的统计
+#define COMPILER_OBJ_CACHE_MAX (32 * 1024 * 1024) // 目标单元缓存持有的符号分配区总量上限
+
+namespace clib {
+
+    // 待编译程序，#include已由宿主展开
+    struct csource_t {
+        string_t path;
+        string_t code; // 按拓扑序拼接的完整源码
+        std::vector<string_t> units; // 拓扑序，依赖在前
+        std::unordered_map<string_t, string_t> unit_code;
+        std::unordered_map<string_t, std::unordered_set<string_t>> unit_dep;
+        double include_time{ 0 }; // 宿主展开#include的耗时，毫秒
+    };
+
+    // 单次编译的统计，时间单位为毫秒，计数为所有重新编译的单元之和
+    struct ccompile_stat_t {
+        string_t path;
+        double include{ 0 };
+        double lexer{ 0 };
+        double parser{ 0 }; // 不含词法分析
+        double gen{ 0 };
+        double link{ 0 };
+        double total{ 0 }; // 编译线程内的总耗时，不含include
+        int units{ 0 }; // 重新编译的单元数
+        int units_cached{ 0 };
+        int tokens{ 0 };
+        int backtracks{ 0 };
+        int ast_nodes{ 0 };
+        size_t ast_bytes{ 0 };
+        int symbols{ 0 };
+        size_t symbol_bytes{ 0 };
+        int instructions{ 0 };
+        bool disk_cached{ false };
+        bool fallback{ false }; // 退回整体编译
+        bool failed{ false };
+
+        void add(const ccompile_stat_t& s);
+    };
+
+    enum compile_state_t {
+        cs_none,
+        cs_pending,
+        cs_done,
+        cs_failed,
+    };
+
+    // 后台编译服务：每个线程持有独立的分析器与代码生成器，共享只读文法与目标单元
+    class ccompiler {
+    public:
+        explicit ccompiler(int workers = COMPILER_WORKERS, bool disk_cache = true);
+        ~ccompiler();
+
+        ccompiler(const ccompiler&) = delete;
+        ccompiler& operator=(const ccompiler&) = delete;
+
+        void submit(const csource_t& src);
+        compile_state_t query(const string_t& path, std::vector<byte>& file, int& fail_errno);
+        std::vector<string_t> invalidate(const std::unordered_set<string_t>& paths);
+
+        std::vector<ccompile_stat_t> get_stats() const;
+        ccompile_stat_t get_total() const;
+        string_t report() const;
+
+    private:
+        struct job_t {
+            csource_t src;
+            int version;
+        };
+
+        void worker();
+        int build(cparser& p, cgen& gen, const csource_t& src, std::vector<byte>& file, ccompile_stat_t& stat);
+        bool link_units(cparser& p, cgen& gen, const csource_t& src, std::vector<byte>& file, ccompile_stat_t& stat);
+
+        static string_t cache_file(const string_t& code);
+        static bool load_cache(const string_t& code, std::vector<byte>& file);
+        static void save_cache(const string_t& code, const std::vector<byte>& file);
+
+    private:
+        struct result_t {
+            compile_state_t state{ cs_none };
+            std::vector<byte> file;
+            int fail_errno{ -1 };
+            int version{ 0 }; // 失效后重新提交，旧任务的结果作废
+        };
+        struct obj_t {
+            uint64_t hash; // 单元及其依赖的源码摘要
+            cobj_t::ref obj;
+            uint64_t tick; // 最近使用时刻，淘汰时用
+        };
+        void cache_put(const string_t& unit, uint64_t hash, const cobj_t::ref& obj);
+        std::vector<std::thread> threads;
+        mutable std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<job_t> jobs;
+        std::unordered_map<string_t, result_t> results;
+        int version{ 0 };
+        bool stopped{ false };
+        bool disk_cache;
+        std::deque<ccompile_stat_t> history;
+        ccompile_stat_t total;
+        std::mutex mtx_obj;
+        std::unordered_map<string_t, obj_t> cache_obj;
+        uint64_t obj_tick{ 0 };
+    };
+}
+
+#endif //CMINILANG_COMPILER_H
@@ -6,14 +6,23 @@
 #include "stdafx.h"
 #include <iostream>
 #include <iterator>
+#include <algorithm>
+#include <map>
 #include <unordered_set>
 #include <iomanip>
+#include <climits>
+#include <cstring>
 #include "cgen.h"
 #include "cast.h"
 #include "cvm.h"
 #include "cexception.h"
 
 #define LOG_TYPE 0
+#define LOG_INLINE 0
+
+#define SWITCH_MIN_CASES 4 // 少于此数的switch用CASE链
+#define SWITCH_MAX_RANGE 1024 // 跳转表最大长度
+#define SWITCH_DENSITY 3 // 跳转表长度不超过case数的倍数
 
 #define AST_IS_KEYWORD(node) ((node)->flag == ast_keyword)
 #define AST_IS_KEYWORD_K(node, k) ((node)->data._keyword == (k))
@@ -317,6 +326,7 @@ namespace clib {
         if (clazz == z_global_var) {
             // gen.error("global id cannot be modified");
             gen.emit(IMM, DATA_BASE | addr);
+            gen.reloc(r_data, unit);
             return g_no_load;
         }
         else if (clazz == z_local_var) {
@@ -334,6 +344,7 @@ namespace clib {
     gen_t sym_id_t::gen_rvalue(igen & gen) {
         if (clazz == z_global_var) {
             gen.emit(IMM, DATA_BASE | addr);
+            gen.reloc(r_data, unit);
             if (base->ptr == 0)
                 gen.emit(LOAD, base->size(x_load));
         }
@@ -342,6 +353,9 @@ namespace clib {
             gen.emit(LOAD, base->size(x_load));
         }
         else if (clazz == z_param_var) {
+            auto exp = gen.bound(this);
+            if (exp)
+                return gen_bind(gen, exp);
             gen.emit(LEA, addr);
             gen.emit(LOAD, base->size(x_load));
         }
@@ -350,6 +364,7 @@ namespace clib {
         }
         else if (clazz == z_function) {
             gen.emit(IMM, USER_BASE | addr);
+            gen.reloc(r_text, unit);
         }
         return g_ok;
     }
@@ -503,6 +518,17 @@ namespace clib {
     }
 
     gen_t sym_func_t::gen_invoke(igen & gen, sym_t::ref & list) {
+        auto total_size = gen_args(gen, list);
+        gen.emit(IMM, addr);
+        gen.reloc(r_text, unit);
+        gen.emit(CALL);
+        if (total_size > 0) {
+            gen.emit(ADJ, total_size / 4);
+        }
+        return g_ok;
+    }
+
+    int sym_func_t::gen_args(igen & gen, sym_t::ref & list) {
         assert(list->get_type() == s_list);
         auto args = std::dynamic_pointer_cast<sym_list_t>(list);
         auto & exps = args->exps;
@@ -526,18 +552,234 @@ namespace clib {
             gen.emit(PUSH, c);
             total_size += c;
         }
-        gen.emit(IMM, addr);
-        gen.emit(CALL);
-        if (!exps.empty()) {
-            gen.emit(ADJ, total_size / 4);
+        return total_size;
+    }
+
+    int sym_func_t::args_size() const {
+        auto total_size = 0;
+        for (auto& param : params) {
+            auto param_type = param->base->get_cast();
+            total_size += param_type == t_struct ? param->size(x_size) : cast_size(param_type);
         }
-        return g_ok;
+        return total_size;
     }
 
     cast_t sym_func_t::get_cast() const {
         return t_ptr;
     }
 
+    // 内联分析：按求值顺序遍历表达式，只接受无副作用的结点
+    struct inline_scan_t {
+        const std::vector<sym_id_t::ref>* params{ nullptr };
+        std::vector<int> uses; // 形参引用顺序
+        int size{ 0 }; // 结点数
+        bool reads{ false }; // 已读取形参以外的存储
+        bool ordered{ true }; // 形参引用之前未读取其他存储
+        bool effects{ false }; // 已执行中断
+        bool ok{ true };
+    };
+
+    static void inline_scan(const sym_t::ref & s, inline_scan_t & scan) {
+        if (!scan.ok)
+            return;
+        scan.size++;
+        switch (s->get_type()) {
+        case s_var:
+            break;
+        case s_var_id: {
+            auto id = std::dynamic_pointer_cast<sym_var_id_t>(s)->id.lock();
+            if (id && id->get_type() == s_function)
+                break;
+            auto var = std::dynamic_pointer_cast<sym_id_t>(id);
+            if (!var || var->get_cast() == t_struct) {
+                scan.ok = false;
+                break;
+            }
+            if (scan.params) {
+                auto f = std::find(scan.params->begin(), scan.params->end(), var);
+                if (f != scan.params->end()) {
+                    if (scan.effects) // 中断之后的形参引用须在调用前求值
+                        scan.ok = false;
+                    if (scan.reads)
+                        scan.ordered = false;
+                    scan.uses.push_back(f - scan.params->begin());
+                    break;
+                }
+            }
+            if (var->clazz == z_global_var || var->clazz == z_local_var || var->clazz == z_param_var)
+                scan.reads = true;
+            else
+                scan.ok = false;
+        }
+                       break;
+        case s_cast:
+            inline_scan(std::dynamic_pointer_cast<sym_cast_t>(s)->exp, scan);
+            break;
+        case s_unop: {
+            auto unop = std::dynamic_pointer_cast<sym_unop_t>(s);
+            if (!AST_IS_OP(unop->op)) {
+                scan.ok = false;
+                break;
+            }
+            switch (unop->op->data._op) {
+            case op_plus:
+            case op_minus:
+            case op_bit_not:
+            case op_logical_not:
+                inline_scan(unop->exp, scan);
+                break;
+            case op_times:
+                inline_scan(unop->exp, scan);
+                scan.reads = true;
+                break;
+            default:
+                scan.ok = false;
+                break;
+            }
+        }
+                     break;
+        case s_binop: {
+            auto binop = std::dynamic_pointer_cast<sym_binop_t>(s);
+            switch (binop->op->data._op) {
+            case op_equal:
+            case op_plus:
+            case op_minus:
+            case op_times:
+            case op_divide:
+            case op_bit_and:
+            case op_bit_or:
+            case op_bit_xor:
+            case op_mod:
+            case op_less_than:
+            case op_less_than_or_equal:
+            case op_greater_than:
+            case op_greater_than_or_equal:
+            case op_not_equal:
+            case op_left_shift:
+            case op_right_shift:
+                inline_scan(binop->exp1, scan);
+                inline_scan(binop->exp2, scan);
+                break;
+            default:
+                scan.ok = false;
+                break;
+            }
+        }
+                      break;
+        default:
+            scan.ok = false;
+            break;
+        }
+    }
+
+    // 直接调用的函数，经函数指针调用时为空
+    static std::shared_ptr<sym_func_t> sym_callee(const type_exp_t::ref & exp) {
+        sym_t::ref callee = exp;
+        if (callee->get_type() == s_var_id)
+            callee = std::dynamic_pointer_cast<sym_var_id_t>(callee)->id.lock();
+        if (!callee || callee->get_type() != s_function)
+            return nullptr;
+        return std::dynamic_pointer_cast<sym_func_t>(callee);
+    }
+
+    // 复制函数体再生成，生成时会改写结点的base；导入单元的符号可能被多个编译任务共享，不能就地修改
+    static sym_t::ref inline_clone(const sym_t::ref & s) {
+        switch (s->get_type()) {
+        case s_var:
+            return std::make_shared<sym_var_t>(*std::dynamic_pointer_cast<sym_var_t>(s));
+        case s_var_id:
+            return std::make_shared<sym_var_id_t>(*std::dynamic_pointer_cast<sym_var_id_t>(s));
+        case s_cast: {
+            auto cast = std::make_shared<sym_cast_t>(*std::dynamic_pointer_cast<sym_cast_t>(s));
+            cast->exp = std::dynamic_pointer_cast<type_exp_t>(inline_clone(cast->exp));
+            return cast;
+        }
+        case s_unop: {
+            auto unop = std::make_shared<sym_unop_t>(*std::dynamic_pointer_cast<sym_unop_t>(s));
+            unop->exp = std::dynamic_pointer_cast<type_exp_t>(inline_clone(unop->exp));
+            return unop;
+        }
+        case s_binop: {
+            auto binop = std::make_shared<sym_binop_t>(*std::dynamic_pointer_cast<sym_binop_t>(s));
+            binop->exp1 = std::dynamic_pointer_cast<type_exp_t>(inline_clone(binop->exp1));
+            binop->exp2 = std::dynamic_pointer_cast<type_exp_t>(inline_clone(binop->exp2));
+            return binop;
+        }
+        case s_ctrl: {
+            auto ctrl = std::make_shared<sym_ctrl_t>(*std::dynamic_pointer_cast<sym_ctrl_t>(s));
+            if (ctrl->exp)
+                ctrl->exp = std::dynamic_pointer_cast<type_exp_t>(inline_clone(ctrl->exp));
+            return ctrl;
+        }
+        default:
+            return s;
+        }
+    }
+
+    bool sym_func_t::can_inline(const sym_t::ref & list) const {
+        if (!inline_ok || list->get_type() != s_list)
+            return false;
+        auto& exps = std::dynamic_pointer_cast<sym_list_t>(list)->exps;
+        if (exps.size() != params.size())
+            return false;
+        if (inline_ordered)
+            return true;
+        for (auto& exp : exps) { // 形参可能被重复引用或不引用，实参须无副作用
+            inline_scan_t scan;
+            inline_scan(exp, scan);
+            if (!scan.ok)
+                return false;
+        }
+        return true;
+    }
+
+    bool sym_func_t::gen_inline(igen & gen, sym_t::ref & list, const sym_t & site) {
+        if (!can_inline(list))
+            return false;
+        auto& exps = std::dynamic_pointer_cast<sym_list_t>(list)->exps;
+        igen::bind_t args;
+        for (size_t i = 0; i < params.size(); ++i) {
+            args.insert({ params[i].get(), exps[i] });
+        }
+        gen.bind(args);
+        for (auto& s : inline_body) {
+            inline_clone(s)->gen_rvalue(gen);
+        }
+        gen.unbind();
+        gen.inlined(id, site.line, site.column);
+        return true;
+    }
+
+    gen_t sym_id_t::gen_bind(igen & gen, const type_exp_t::ref & exp) {
+        // 就地计算实参，效果同压栈后按形参类型读取；实参属于调用方，不受本次绑定影响
+        gen.bind(igen::bind_t());
+        exp->gen_rvalue(gen);
+        gen.unbind();
+        auto src = exp->base->get_cast();
+        auto dst = base->get_cast();
+        auto s = cast_find(src, dst);
+        if (s == -1)
+            gen.error("invoke: argument unsupported cast, required: " + to_string() +
+                ", but got: " + exp->to_string());
+        if (s != 0) {
+            gen.emit(CAST, s);
+        }
+        if (dst == t_char || dst == t_uchar) { // 形参按单字节读取
+            auto loaded = src == dst && (exp->get_type() == s_var_id ||
+                (exp->get_type() == s_unop && AST_IS_OP_N(std::dynamic_pointer_cast<sym_unop_t>(exp)->op, op_times)));
+            if (exp->get_type() == s_var && src <= t_uint) {
+                auto n = std::dynamic_pointer_cast<sym_var_t>(exp)->node;
+                loaded = n->data._int >= 0 && n->data._int <= 0xff;
+            }
+            if (!loaded) {
+                gen.emit(PUSH, cast_size(t_int));
+                gen.emit(IMM, 0xff);
+                gen.emit(AND, t_int);
+            }
+        }
+        return g_ok;
+    }
+
     type_exp_t::type_exp_t(const type_t::ref & base) : base(base) {}
 
     symbol_t type_exp_t::get_type() const {
@@ -585,6 +827,7 @@ namespace clib {
     gen_t sym_var_t::gen_lvalue(igen & gen) {
         if (node->flag == ast_string) {
             gen.emit(IMM, DATA_BASE | gen.load_string(node->data._string));
+            gen.reloc(r_data, "");
             base = std::make_shared<type_base_t>(l_char, 1);
             return g_no_load;
         }
@@ -610,6 +853,7 @@ namespace clib {
             break;
         case ast_string:
             gen.emit(IMM, DATA_BASE | gen.load_string(node->data._string));
+            gen.reloc(r_data, "");
             break;
         case ast_keyword: {
             if (AST_IS_KEYWORD_K(node, k_true))
@@ -1251,6 +1495,10 @@ namespace clib {
                          break;
         case op_lparan: {
             auto exp = std::dynamic_pointer_cast<sym_t>(exp2);
+#if CGEN_INLINE
+            auto f = sym_callee(exp1);
+            if (!f || !f->gen_inline(gen, exp, *this))
+#endif
             exp1->gen_invoke(gen, exp);
             base = exp1->base->clone();
         }
@@ -1402,9 +1650,11 @@ namespace clib {
 #if LOG_TYPE
             std::cout << "[DEBUG] Return: exp= " << sym_to_string(exp) << std::endl;
 #endif
+            if (exp && gen_tail(gen))
+                break;
             if (exp)
                 exp->gen_rvalue(gen);
-            gen.emit(LEV);
+            gen.emit(func && func->frameless ? RET : LEV);
         }
                        break;
         case k_break:
@@ -1427,6 +1677,134 @@ namespace clib {
         return g_ok;
     }
 
+    bool sym_ctrl_t::gen_tail(igen & gen) {
+        // return f(...)：参数大小相同时复用当前栈帧
+        if (!func || func->frameless || func->frame_escape || exp->get_type() != s_binop)
+            return false;
+        auto binop = std::dynamic_pointer_cast<sym_binop_t>(exp);
+        if (!AST_IS_OP_K(binop->op, op_lparan))
+            return false;
+        auto f = sym_callee(binop->exp1);
+        if (!f || f->args_size() != func->args_size())
+            return false;
+        auto list = std::dynamic_pointer_cast<sym_t>(binop->exp2);
+#if CGEN_INLINE
+        if (f->can_inline(list)) // 内联优先于尾调用
+            return false;
+#endif
+#if LOG_TYPE
+        std::cout << "[DEBUG] Tail call: " << f->to_string() << std::endl;
+#endif
+        auto total_size = f->gen_args(gen, list);
+        gen.emit(IMM, f->addr);
+        gen.reloc(r_text, f->unit);
+        gen.emit(TAIL, total_size / 4);
+        return true;
+    }
+
+    // --------------------------------------------------------------
+
+    int sym_table::intern(const string_t& name) {
+        auto f = ids.find(name);
+        if (f != ids.end())
+            return f->second;
+        auto id = (int)names.size();
+        ids.insert(std::make_pair(name, id));
+        names.push_back(name);
+        globals.emplace_back();
+        heads.push_back(-1);
+        return id;
+    }
+
+    const string_t& sym_table::name(int id) const {
+        return names[id];
+    }
+
+    int sym_table::id_of(const string_t& name) const {
+        auto f = ids.find(name);
+        return f == ids.end() ? -1 : f->second;
+    }
+
+    void sym_table::push() {
+        marks.push_back(entries.size());
+    }
+
+    void sym_table::pop() {
+        assert(!marks.empty());
+        auto mark = marks.back();
+        marks.pop_back();
+        while (entries.size() > mark) {
+            auto& e = entries.back();
+            heads[e.id] = e.prev;
+            entries.pop_back();
+        }
+    }
+
+    int sym_table::level() const {
+        return (int)marks.size();
+    }
+
+    bool sym_table::insert(const string_t& name, const sym_t::ref& sym) {
+        if (marks.empty())
+            return insert_global(name, sym);
+        auto id = intern(name);
+        auto head = heads[id];
+        if (head != -1 && entries[head].level == level())
+            return false;
+        entries.push_back({ id, level(), head, sym });
+        heads[id] = (int)entries.size() - 1;
+        return true;
+    }
+
+    bool sym_table::insert_global(const string_t& name, const sym_t::ref& sym) {
+        auto id = intern(name);
+        if (globals[id])
+            return false;
+        globals[id] = sym;
+        return true;
+    }
+
+    void sym_table::erase_global(const string_t& name) {
+        auto id = id_of(name);
+        if (id != -1)
+            globals[id] = nullptr;
+    }
+
+    sym_t::ref sym_table::find(const string_t& name) const {
+        auto id = id_of(name);
+        if (id == -1)
+            return nullptr;
+        if (heads[id] != -1)
+            return entries[heads[id]].sym;
+        return globals[id];
+    }
+
+    sym_t::ref sym_table::find_scope(const string_t& name) const {
+        auto id = id_of(name);
+        if (id == -1)
+            return nullptr;
+        if (marks.empty())
+            return globals[id];
+        auto head = heads[id];
+        if (head != -1 && entries[head].level == level())
+            return entries[head].sym;
+        return nullptr;
+    }
+
+    sym_t::ref sym_table::find_global(const string_t& name) const {
+        auto id = id_of(name);
+        return id == -1 ? nullptr : globals[id];
+    }
+
+    void sym_table::clear() {
+        ids.clear();
+        names.clear();
+        globals.clear();
+        heads.clear();
+        entries.clear();
+        marks.clear();
+    }
+
     // --------------------------------------------------------------
 
     cgen::cgen() {
@@ -1435,11 +1813,22 @@ namespace clib {
 
     void cgen::gen(ast_node * node) {
         gen_rec(node, 0);
+#if CGEN_INLINE && LOG_INLINE
+        if (!inlines.empty()) {
+            std::map<string_t, int> count;
+            for (auto& i : inlines) {
+                count[i.callee]++;
+            }
+            for (auto& c : count) {
+                ATLTRACE("[SYSTEM] GEN  | Inline: %s x %d\n", c.first.c_str(), c.second);
+            }
+        }
+#endif
     }
 
     void cgen::reset() {
         symbols.clear();
-        symbols.emplace_back();
+        arena = std::make_shared<sym_arena>();
         tmp.clear();
         tmp.emplace_back();
         ast.clear();
@@ -1449,27 +1838,138 @@ namespace clib {
         cases.clear();
         ctx.reset();
         cycle.clear();
+        relocs.clear();
+        imports.clear();
+        imported.clear();
+        inline_collect = false;
+        inline_body.clear();
+        inlines.clear();
+        binds.clear();
+        checked.clear();
+        sym_count = 0;
     }
 
     std::vector<byte> cgen::file() const {
-        std::vector<byte> file;
-        auto entry = symbols[0].find("main");
-        if (entry == symbols[0].end()) {
+        auto entry = symbols.find_global("main");
+        if (!entry) {
             error("main() not defined");
         }
+        return file(std::dynamic_pointer_cast<sym_func_t>(entry)->addr, data, text);
+    }
+
+    void cgen::import(const cobj_t::ref & obj) {
+        if (!imports.insert(std::make_pair(obj->path, obj)).second)
+            return;
+        for (auto& s : obj->symbols) {
+            if (!symbols.insert_global(s.first, s.second)) {
+                error("import: conflict symbol " + s.first + " in " + obj->path);
+            }
+            imported.insert(s.first);
+        }
+    }
+
+    cobj_t::ref cgen::object(const string_t & path) {
+        auto obj = std::make_shared<cobj_t>();
+        obj->path = path;
+        obj->text = text;
+        obj->data = data;
+        obj->relocs = relocs;
+        symbols.for_each_global([&](const string_t& name, const sym_t::ref& s) {
+            if (imported.find(name) != imported.end())
+                return;
+            auto id = std::dynamic_pointer_cast<sym_id_t>(s);
+            if (id) {
+                id->unit = path;
+                id->init.reset(); // 初值引用的语法树随编译结束释放
+            }
+            obj->symbols.insert(std::make_pair(name, s));
+        });
+        obj->retained = arena->capacity();
+        return obj;
+    }
+
+    std::vector<byte> cgen::link(const std::vector<cobj_t::ref> & objs) const {
+        if (objs.empty())
+            error("link: no unit");
+        std::vector<LEX_T(int)> _text;
+        std::vector<LEX_T(char)> _data;
+        std::unordered_map<string_t, std::pair<int, int>> bases; // 单元 -> (代码基址, 数据基址)
+        for (auto& obj : objs) {
+            while (_data.size() % 4 != 0) {
+                _data.push_back(0);
+            }
+            bases.insert(std::make_pair(obj->path, std::make_pair((int)_text.size(), (int)_data.size())));
+            std::copy(obj->text.begin(), obj->text.end(), std::back_inserter(_text));
+            std::copy(obj->data.begin(), obj->data.end(), std::back_inserter(_data));
+        }
+        for (auto& obj : objs) {
+            auto& base = bases[obj->path];
+            auto tb = base.first, db = base.second;
+            // 单元内跳转按指令边界解码后平移
+            for (auto i = tb; i < tb + (int)obj->text.size(); i += INS_SIZE((ins_t)_text[i])) {
+                switch (_text[i]) {
+                case JMP:
+                case JZ:
+                case JNZ:
+                    _text[i + 1] += tb;
+                    break;
+                case JTAB: {
+                    auto table = (int*)(_data.data() + db + (_text[i + 1] & 0x0FFFFFFF));
+                    _text[i + 1] += db;
+                    table[2] += tb;
+                    for (auto j = 0; j < table[1]; ++j) {
+                        table[3 + j] += tb;
+                    }
+                }
+                           break;
+                case JMAP: {
+                    auto table = (int*)(_data.data() + db + (_text[i + 1] & 0x0FFFFFFF));
+                    _text[i + 1] += db;
+                    table[1] += tb;
+                    for (auto j = 0; j < table[0]; ++j) {
+                        table[3 + j * 2] += tb;
+                    }
+                }
+                           break;
+                default:
+                    break;
+                }
+            }
+            // 符号与字符串引用
+            for (auto& r : obj->relocs) {
+                auto owner = base;
+                if (!r.unit.empty()) {
+                    auto f = bases.find(r.unit);
+                    if (f == bases.end())
+                        error("link: unresolved unit " + r.unit + " in " + obj->path);
+                    owner = f->second;
+                }
+                _text[tb + r.pos] += r.type == r_text ? owner.first : owner.second;
+            }
+        }
+        auto& unit = objs.back();
+        auto entry = unit->symbols.find("main");
+        if (entry == unit->symbols.end() || entry->second->get_type() != s_function) {
+            error("main() not defined");
+        }
+        auto addr = std::dynamic_pointer_cast<sym_func_t>(entry->second)->addr + bases[unit->path].first;
+        return file((uint)addr, _data, _text);
+    }
+
+    std::vector<byte> cgen::file(uint addr, const std::vector<LEX_T(char)> & _data, const std::vector<LEX_T(int)> & _text) const {
+        std::vector<byte> file;
         auto magic = string_t(PE_MAGIC);
         std::copy((byte*)magic.data(), (byte*)magic.data() + magic.size(), std::back_inserter(file));
-        auto addr = std::dynamic_pointer_cast<sym_func_t>(entry->second)->addr;
         auto size = sizeof(addr);
         std::copy((byte*)& addr, ((byte*)& addr) + size, std::back_inserter(file));
-        auto data_size = data.size() * sizeof(data[0]);
+        auto data_size = _data.size() * sizeof(_data[0]);
         size = sizeof(data_size);
         std::copy((byte*)& data_size, ((byte*)& data_size) + size, std::back_inserter(file));
-        auto text_size = text.size() * sizeof(text[0]);
+        auto text_size = _text.size() * sizeof(_text[0]);
         size = sizeof(text_size);
         std::copy((byte*)& text_size, ((byte*)& text_size) + size, std::back_inserter(file));
-        std::copy(data.begin(), data.end(), std::back_inserter(file));
-        std::copy((byte*)text.data(), ((byte*)text.data()) + text_size, std::back_inserter(file));
+        std::copy(_data.begin(), _data.end(), std::back_inserter(file));
+        std::copy((byte*)_text.data(), ((byte*)_text.data()) + text_size, std::back_inserter(file));
         return file;
     }
 
@@ -1569,6 +2069,111 @@ namespace clib {
         return addr;
     }
 
+    void cgen::reloc(reloc_t type, const string_t & unit) {
+        relocs.push_back({ (int)text.size() - 1, type, unit });
+    }
+
+    void cgen::inlined(const string_t & name, int line, int column) {
+        auto f = ctx.lock();
+        inlines.push_back({ name, f && f->get_type() == s_function ? f->get_name() : "", line, column });
+    }
+
+    void cgen::bind(const bind_t & args) {
+        binds.push_back(args);
+    }
+
+    void cgen::unbind() {
+        binds.pop_back();
+    }
+
+    std::shared_ptr<type_exp_t> cgen::bound(const sym_t * param) const {
+        if (binds.empty())
+            return nullptr;
+        auto f = binds.back().find(param);
+        return f == binds.back().end() ? nullptr : f->second;
+    }
+
+    const std::vector<inline_t>& cgen::get_inlines() const {
+        return inlines;
+    }
+
+    cgen_stat_t cgen::get_stat() const {
+        cgen_stat_t stat;
+        for (size_t i = 0; i < text.size(); i += INS_SIZE((ins_t)text[i])) {
+            stat.instructions++;
+        }
+        stat.symbols = sym_count;
+        stat.symbol_bytes = arena->used();
+        return stat;
+    }
+
+    int cgen::load_table(const std::vector<int> & table) {
+        while (data.size() % 4 != 0) {
+            data.push_back(0);
+        }
+        auto addr = data.size();
+        std::copy((char*)table.data(), (char*)(table.data() + table.size()), std::back_inserter(data));
+        return addr;
+    }
+
+    bool cgen::gen_switch_table(ast_node * k, const std::vector<switch_t> & _cases, int _default) {
+        std::vector<std::pair<int, int>> keys; // (值, 地址)
+        for (auto& _c : _cases) {
+            if (!_c._case)
+                continue;
+            if (_c._case->get_type() != s_var)
+                return false;
+            auto node = std::dynamic_pointer_cast<sym_var_t>(_c._case)->node;
+            switch ((ast_t)node->flag) {
+            case ast_char:
+            case ast_uchar:
+            case ast_short:
+            case ast_ushort:
+            case ast_int:
+            case ast_uint:
+                break;
+            default:
+                return false;
+            }
+            keys.emplace_back(node->data._ins._1, _c.addr);
+        }
+        if (keys.size() < SWITCH_MIN_CASES)
+            return false;
+        std::sort(keys.begin(), keys.end());
+        for (size_t i = 1; i < keys.size(); ++i) {
+            if (keys[i].first == keys[i - 1].first)
+                error(k, "duplicate case: ", true);
+        }
+        auto end = (int)text.size() + 4; // POP + JTAB/JMAP
+        auto def = _default != -1 ? _cases[_default].addr : end;
+        auto low = (int64)keys.front().first;
+        auto range = (int64)keys.back().first - low + 1;
+        if (range <= SWITCH_MAX_RANGE && range <= (int64)keys.size() * SWITCH_DENSITY) {
+            // 稠密：[low, count, default, addr...]
+            std::vector<int> table{ (int)low, (int)range, def };
+            table.resize(3 + (size_t)range, def);
+            for (auto& key : keys) {
+                table[3 + (size_t)(key.first - low)] = key.second;
+            }
+            emit(POP, 4);
+            emit(JTAB, DATA_BASE | load_table(table));
+        }
+        else {
+            // 稀疏：[count, default, (key, addr)...]，按key有序，由虚拟机二分查找
+            std::vector<int> table{ (int)keys.size(), def };
+            for (auto& key : keys) {
+                table.push_back(key.first);
+                table.push_back(key.second);
+            }
+            emit(POP, 4);
+            emit(JMAP, DATA_BASE | load_table(table));
+        }
+#if LOG_TYPE
+        std::cout << "[DEBUG] Switch: cases= " << keys.size() << ", range= " << range << std::endl;
+#endif
+        return true;
+    }
+
     template<class T>
     static void gen_recursion(ast_node * node, int level, T f) {
         if (node == nullptr)
@@ -1605,6 +2210,665 @@ namespace clib {
         return v;
     }
 
+    // 扫描函数体：是否有局部变量、是否可能取栈上地址、是否有switch（执行时残留在栈上）
+    // 结构体局部变量/参数及成员访问（s.buf）均以栈上地址参与运算，一律视为外泄
+    static void gen_frame_scan(ast_node * node, bool & locals, bool & escape, bool & pushes, bool decl = false) {
+        for (auto& i : gen_get_children(node)) {
+            if (AST_IS_COLL(i)) {
+                auto sub = decl;
+                switch (i->data._coll) {
+                case c_declaration:
+                case c_forDeclaration:
+                    locals = true;
+                    sub = true;
+                    break;
+                case c_parameterDeclaration:
+                    sub = true;
+                    break;
+                case c_structOrUnionSpecifier:
+                    if (decl)
+                        escape = true;
+                    break;
+                case c_unaryExpression:
+                    if (AST_IS_OP_N(i->child, op_bit_and))
+                        escape = true;
+                    break;
+                case c_directDeclarator:
+                    if (i->child->next != i->child && AST_IS_OP_N(i->child->next, op_lsquare))
+                        escape = true;
+                    break;
+                default:
+                    break;
+                }
+                gen_frame_scan(i->child, locals, escape, pushes, sub);
+            }
+            else if (AST_IS_KEYWORD_N(i, k_switch)) {
+                pushes = true;
+            }
+            else if (AST_IS_OP_N(i, op_dot)) {
+                escape = true;
+            }
+        }
+    }
+
+#if CGEN_INLINE
+    // 扫描函数体：只含表达式语句、interrupt及return时作为内联候选
+    static bool gen_inline_scan(ast_node * node) {
+        for (auto& i : gen_get_children(node)) {
+            if (AST_IS_COLL(i)) {
+                switch (i->data._coll) {
+                case c_declaration:
+                case c_compoundStatement:
+                case c_labeledStatement:
+                case c_selectionStatement:
+                case c_iterationStatement:
+                    return false;
+                default:
+                    break;
+                }
+                if (!gen_inline_scan(i->child))
+                    return false;
+            }
+        }
+        return true;
+    }
+#endif
+
+#if CGEN_OPT
+    // --------------------------------------------------------------
+    // 表达式优化：常量折叠、代数化简、强度削减
+    // 仅处理类型在构造时即可确定（字面量、变量）且无需隐式转换的情形，折叠结果与虚拟机执行结果一致
+
+    struct opt_value_t {
+        cast_t type;
+        union {
+            int _int;
+            uint _uint;
+            int64 _long;
+            uint64 _ulong;
+            float _float;
+            double _double;
+        };
+    };
+
+    static bool opt_integer(cast_t type) {
+        return type == t_int || type == t_uint || type == t_long || type == t_ulong;
+    }
+
+    static bool opt_unsigned(cast_t type) {
+        return type == t_uint || type == t_ulong;
+    }
+
+    static bool opt_const(const type_exp_t::ref & exp) {
+        if (!exp || exp->get_type() != s_var)
+            return false;
+        auto node = std::static_pointer_cast<sym_var_t>(exp)->node;
+        switch (node->flag) {
+        case ast_int:
+        case ast_uint:
+        case ast_long:
+        case ast_ulong:
+        case ast_float:
+        case ast_double:
+            return true;
+        case ast_keyword:
+            return AST_IS_KEYWORD_K(node, k_true) || AST_IS_KEYWORD_K(node, k_false);
+        default:
+            return false;
+        }
+    }
+
+    static opt_value_t opt_value(const type_exp_t::ref & exp) {
+        auto node = std::static_pointer_cast<sym_var_t>(exp)->node;
+        opt_value_t v;
+        v._ulong = 0;
+        switch (node->flag) {
+        case ast_int: v.type = t_int; v._int = node->data._int; break;
+        case ast_uint: v.type = t_uint; v._uint = node->data._uint; break;
+        case ast_long: v.type = t_long; v._long = node->data._long; break;
+        case ast_ulong: v.type = t_ulong; v._ulong = node->data._ulong; break;
+        case ast_float: v.type = t_float; v._float = node->data._float; break;
+        case ast_double: v.type = t_double; v._double = node->data._double; break;
+        default: v.type = t_int; v._int = AST_IS_KEYWORD_K(node, k_true) ? 1 : 0; break;
+        }
+        return v;
+    }
+
+    // 构造时即确定类型的表达式
+    static cast_t opt_cast(const type_exp_t::ref & exp) {
+        if (exp->get_type() != s_var && exp->get_type() != s_var_id)
+            return t_error;
+        return exp->base ? exp->base->get_cast() : t_error;
+    }
+
+    // 条件跳转只看低32位，返回-1表示非常量
+    static int opt_truth(const type_exp_t::ref & exp) {
+        auto e = exp;
+        if (e->get_type() == s_list) {
+            auto& exps = std::static_pointer_cast<sym_list_t>(e)->exps;
+            if (exps.size() != 1)
+                return -1;
+            e = exps[0];
+        }
+        if (!opt_const(e))
+            return -1;
+        auto v = opt_value(e);
+        return (v._ulong & 0xFFFFFFFFULL) ? 1 : 0;
+    }
+
+    static int opt_log2(const opt_value_t & v) {
+        auto n = v.type == t_int || v.type == t_uint ? (uint64)v._uint : v._ulong;
+        if (v.type == t_int && v._int <= 0)
+            return -1;
+        if (v.type == t_long && v._long <= 0)
+            return -1;
+        if (n < 2 || (n & (n - 1)) != 0)
+            return -1;
+        auto k = 0;
+        while (n > 1) {
+            n >>= 1;
+            k++;
+        }
+        return k;
+    }
+
+    static bool opt_is(const opt_value_t & v, int n) {
+        switch (v.type) {
+        case t_int: return v._int == n;
+        case t_uint: return v._uint == (uint)n;
+        case t_long: return v._long == n;
+        case t_ulong: return v._ulong == (uint64)n;
+        default: return false;
+        }
+    }
+
+    static bool opt_convert(const opt_value_t & v, cast_t type, opt_value_t & r) {
+        r._ulong = 0;
+        r.type = type;
+#define OPT_CONVERT(t) \
+        switch (v.type) { \
+        case t_int: r._##t = (decltype(r._##t))v._int; break; \
+        case t_uint: r._##t = (decltype(r._##t))v._uint; break; \
+        case t_long: r._##t = (decltype(r._##t))v._long; break; \
+        case t_ulong: r._##t = (decltype(r._##t))v._ulong; break; \
+        case t_float: r._##t = (decltype(r._##t))v._float; break; \
+        case t_double: r._##t = (decltype(r._##t))v._double; break; \
+        default: return false; \
+        }
+        switch (type) {
+        case t_int: OPT_CONVERT(int) break;
+        case t_uint: OPT_CONVERT(uint) break;
+        case t_long: OPT_CONVERT(long) break;
+        case t_ulong: OPT_CONVERT(ulong) break;
+        case t_float: OPT_CONVERT(float) break;
+        case t_double: OPT_CONVERT(double) break;
+        default: return false;
+        }
+#undef OPT_CONVERT
+        return true;
+    }
+
+    static bool opt_eval(operator_t op, const opt_value_t & a, const opt_value_t & b, opt_value_t & r) {
+        if (a.type != b.type)
+            return false;
+        auto type = a.type;
+        r._ulong = 0;
+        r.type = type;
+        auto integer = opt_integer(type);
+        auto wide = type == t_long || type == t_ulong;
+        switch (op) {
+        case op_equal:
+        case op_not_equal:
+        case op_less_than:
+        case op_less_than_or_equal:
+        case op_greater_than:
+        case op_greater_than_or_equal: {
+            int c;
+#define OPT_COMPARE(t) \
+            c = a._##t < b._##t ? -1 : (a._##t > b._##t ? 1 : 0); \
+            if (!(a._##t == b._##t) && c == 0) return false;
+            switch (type) {
+            case t_int: OPT_COMPARE(int) break;
+            case t_uint: OPT_COMPARE(uint) break;
+            case t_long: OPT_COMPARE(long) break;
+            case t_ulong: OPT_COMPARE(ulong) break;
+            case t_float: OPT_COMPARE(float) break;
+            case t_double: OPT_COMPARE(double) break;
+            default: return false;
+            }
+#undef OPT_COMPARE
+            r.type = t_int;
+            switch (op) {
+            case op_equal: r._int = c == 0; break;
+            case op_not_equal: r._int = c != 0; break;
+            case op_less_than: r._int = c < 0; break;
+            case op_less_than_or_equal: r._int = c <= 0; break;
+            case op_greater_than: r._int = c > 0; break;
+            default: r._int = c >= 0; break;
+            }
+            return true;
+        }
+        case op_plus:
+        case op_minus:
+        case op_times:
+            if (integer) { // 按无符号运算，与补码回绕一致
+                auto x = wide ? a._ulong : a._uint, y = wide ? b._ulong : b._uint;
+                auto z = op == op_plus ? x + y : (op == op_minus ? x - y : x * y);
+                if (wide)
+                    r._ulong = z;
+                else
+                    r._uint = (uint)z;
+                return true;
+            }
+            if (type == t_float) {
+                r._float = op == op_plus ? a._float + b._float :
+                    (op == op_minus ? a._float - b._float : a._float * b._float);
+                return true;
+            }
+            if (type == t_double) {
+                r._double = op == op_plus ? a._double + b._double :
+                    (op == op_minus ? a._double - b._double : a._double * b._double);
+                return true;
+            }
+            return false;
+        case op_divide:
+        case op_mod: // 除零及溢出留到运行时
+            switch (type) {
+            case t_int:
+                if (b._int == 0 || (a._int == INT_MIN && b._int == -1))
+                    return false;
+                r._int = op == op_divide ? a._int / b._int : a._int % b._int;
+                return true;
+            case t_uint:
+                if (b._uint == 0)
+                    return false;
+                r._uint = op == op_divide ? a._uint / b._uint : a._uint % b._uint;
+                return true;
+            case t_long:
+                if (b._long == 0 || (a._long == INT64_MIN && b._long == -1))
+                    return false;
+                r._long = op == op_divide ? a._long / b._long : a._long % b._long;
+                return true;
+            case t_ulong:
+                if (b._ulong == 0)
+                    return false;
+                r._ulong = op == op_divide ? a._ulong / b._ulong : a._ulong % b._ulong;
+                return true;
+            case t_float:
+                if (op == op_mod || b._float == 0)
+                    return false;
+                r._float = a._float / b._float;
+                return true;
+            case t_double:
+                if (op == op_mod || b._double == 0)
+                    return false;
+                r._double = a._double / b._double;
+                return true;
+            default:
+                return false;
+            }
+        case op_bit_and:
+        case op_bit_or:
+        case op_bit_xor:
+            if (!integer)
+                return false;
+            if (op == op_bit_and)
+                r._ulong = a._ulong & b._ulong;
+            else if (op == op_bit_or)
+                r._ulong = a._ulong | b._ulong;
+            else
+                r._ulong = a._ulong ^ b._ulong;
+            return true;
+        case op_left_shift:
+        case op_right_shift: {
+            if (!integer)
+                return false;
+            auto n = wide ? b._ulong : (uint64)b._uint;
+            if ((type == t_int && b._int < 0) || (type == t_long && b._long < 0) || n >= (wide ? 64U : 32U))
+                return false;
+            switch (type) {
+            case t_int: r._int = op == op_left_shift ? (int)(a._uint << n) : a._int >> n; break;
+            case t_uint: r._uint = op == op_left_shift ? a._uint << n : a._uint >> n; break;
+            case t_long: r._long = op == op_left_shift ? (int64)(a._ulong << n) : a._long >> n; break;
+            default: r._ulong = op == op_left_shift ? a._ulong << n : a._ulong >> n; break;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    ast_node* cgen::new_node(ast_t type, const sym_t::ref & pos) {
+        auto node = arena->alloc<ast_node>();
+        memset(node, 0, sizeof(ast_node));
+        node->flag = type;
+        node->line = pos->line;
+        node->column = pos->column;
+        return node;
+    }
+
+    type_exp_t::ref cgen::new_const(cast_t type, uint64 value, const sym_t::ref & pos) {
+        static const ast_t types[] = { ast_int, ast_uint, ast_long, ast_ulong, ast_float, ast_double };
+        assert(type >= t_int && type <= t_double);
+        auto node = new_node(types[type - t_int], pos);
+        node->data._ulong = value;
+        auto base = make_sym<type_base_t>(cast::ast_lexer((ast_t)node->flag), 0);
+        return make_sym<sym_var_t>(base, node);
+    }
+#endif
+
+    type_exp_t::ref cgen::fold(const type_exp_t::ref & exp) {
+#if CGEN_OPT
+        switch (exp->get_type()) {
+        case s_binop: {
+            auto bin = std::static_pointer_cast<sym_binop_t>(exp);
+            if (!AST_IS_OP(bin->op))
+                break;
+            auto op = bin->op->data._op;
+            auto& exp1 = bin->exp1;
+            auto& exp2 = bin->exp2;
+            if (opt_const(exp1) && opt_const(exp2)) {
+                opt_value_t r;
+                if (opt_eval(op, opt_value(exp1), opt_value(exp2), r))
+                    return new_const(r.type, r._ulong, exp);
+                break;
+            }
+            auto c1 = opt_const(exp1);
+            auto c2 = opt_const(exp2);
+            if (c1 == c2)
+                break;
+            auto& var = c1 ? exp2 : exp1;
+            auto v = opt_value(c1 ? exp1 : exp2);
+            auto type = opt_cast(var);
+            if (!opt_integer(type))
+                break;
+            if (v.type == type) {
+                switch (op) { // 代数化简
+                case op_plus:
+                case op_bit_or:
+                case op_bit_xor:
+                    if (opt_is(v, 0))
+                        return var;
+                    break;
+                case op_minus:
+                case op_left_shift:
+                case op_right_shift:
+                    if (c2 && opt_is(v, 0))
+                        return var;
+                    break;
+                case op_times:
+                    if (opt_is(v, 1))
+                        return var;
+                    break;
+                case op_divide:
+                    if (c2 && opt_is(v, 1))
+                        return var;
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (v.type != type || (c1 && op != op_times))
+                break;
+            auto k = opt_log2(v);
+            if (k <= 0)
+                break;
+            auto unsign = opt_unsigned(type);
+            operator_t new_op; // 强度削减：乘除以2的幂改为移位
+            uint64 value = (uint64)k;
+            switch (op) {
+            case op_times: new_op = op_left_shift; break;
+            case op_times_assign: new_op = op_left_shift_assign; break;
+            case op_divide: new_op = op_right_shift; break;
+            case op_div_assign: new_op = op_right_shift_assign; break;
+            case op_mod: new_op = op_bit_and; value = v._ulong - 1; break;
+            case op_mod_assign: new_op = op_and_assign; value = v._ulong - 1; break;
+            default: return exp;
+            }
+            if (!unsign && new_op != op_left_shift && new_op != op_left_shift_assign)
+                break; // 有符号除法向零取整，不能改为移位
+            auto node = new_node(ast_operator, exp);
+            node->data._op = new_op;
+            return make_sym<sym_binop_t>(var, new_const(type, value, exp), node);
+        }
+        case s_unop: {
+            auto un = std::static_pointer_cast<sym_unop_t>(exp);
+            if (AST_IS_KEYWORD_N(un->op, k_sizeof))
+                return new_const(t_int, (uint)un->exp->size(x_size), exp);
+            if (!AST_IS_OP(un->op) || !opt_const(un->exp))
+                break;
+            auto v = opt_value(un->exp);
+            switch (un->op->data._op) {
+            case op_plus:
+                return un->exp;
+            case op_minus:
+                switch (v.type) {
+                case t_int: v._uint = 0U - v._uint; break;
+                case t_long: v._ulong = 0ULL - v._ulong; break;
+                case t_float: v._float = -v._float; break;
+                case t_double: v._double = -v._double; break;
+                default: return exp;
+                }
+                return new_const(v.type, v._ulong, exp);
+            case op_bit_not:
+                if (!opt_integer(v.type))
+                    break;
+                if (v.type == t_int || v.type == t_uint)
+                    v._uint = ~v._uint;
+                else
+                    v._ulong = ~v._ulong;
+                return new_const(v.type, v._ulong, exp);
+            case op_logical_not:
+                if (v.type != t_int && v.type != t_uint)
+                    break;
+                return new_const(v.type, v._uint ? 0 : 1, exp);
+            default:
+                break;
+            }
+        }
+                     break;
+        case s_cast: {
+            auto c = std::static_pointer_cast<sym_cast_t>(exp);
+            if (!opt_const(c->exp) || c->base->get_type() != s_type_base)
+                break;
+            opt_value_t r;
+            if (opt_convert(opt_value(c->exp), c->base->get_cast(), r))
+                return new_const(r.type, r._ulong, exp);
+        }
+                     break;
+        case s_triop: {
+            auto tri = std::static_pointer_cast<sym_triop_t>(exp);
+            auto cond = opt_truth(tri->exp1);
+            if (cond == 1 && opt_const(tri->exp2))
+                return tri->exp2;
+            if (cond == 0 && opt_const(tri->exp3) && opt_const(tri->exp2) &&
+                opt_value(tri->exp2).type == opt_value(tri->exp3).type)
+                return tri->exp3;
+        }
+                      break;
+        default:
+            break;
+        }
+#endif
+        return exp;
+    }
+
+#if CGEN_OPT
+    // --------------------------------------------------------------
+    // 不可达代码消除
+
+    // return/break/continue语句
+    static bool ast_is_jump(ast_node * node) {
+        while (AST_IS_COLL(node)) {
+            if (AST_IS_COLL_K(node, c_jumpStatement)) {
+                auto k = node->child;
+                return AST_IS_KEYWORD_N(k, k_return) || AST_IS_KEYWORD_N(k, k_break) ||
+                    AST_IS_KEYWORD_N(k, k_continue);
+            }
+            if (!AST_IS_COLL_K(node, c_blockItem) && !AST_IS_COLL_K(node, c_statement))
+                return false;
+            if (!node->child || node->child->next != node->child)
+                return false;
+            node = node->child;
+        }
+        return false;
+    }
+
+    // 含case/default标号的语句可由switch跳入，不可删除
+    static bool ast_has_label(ast_node * node) {
+        if (!AST_IS_COLL(node))
+            return false;
+        if (AST_IS_COLL_K(node, c_labeledStatement))
+            return true;
+        for (auto& i : gen_get_children(node->child)) {
+            if (ast_has_label(i))
+                return true;
+        }
+        return false;
+    }
+
+    static bool ast_is_declaration(ast_node * node) {
+        while (AST_IS_COLL(node)) {
+            if (AST_IS_COLL_K(node, c_declaration))
+                return true;
+            if (!AST_IS_COLL_K(node, c_blockItem) || !node->child || node->child->next != node->child)
+                return false;
+            node = node->child;
+        }
+        return false;
+    }
+
+    void cgen::gen_block(const std::vector<ast_node*> & nodes, int level) {
+        auto dead = false;
+        for (auto& n : nodes) {
+            if (dead) { // 跳转之后、下一标号之前的语句不可达，声明仍需登记
+                if (ast_is_declaration(n)) {
+                    gen_rec(n, level);
+                    continue;
+                }
+                if (!ast_has_label(n))
+                    continue;
+                dead = false;
+            }
+            gen_rec(n, level);
+            dead = ast_is_jump(n);
+        }
+    }
+#endif
+
+#if CGEN_INLINE
+    // --------------------------------------------------------------
+    // 函数内联：函数体只有无副作用的表达式、中断及末尾return时，在调用处展开
+
+    void cgen::inline_func(const std::shared_ptr<sym_func_t> & func) {
+        if (!inline_collect)
+            return;
+        inline_collect = false;
+        std::vector<sym_t::ref> body;
+        body.swap(inline_body);
+        for (auto& param : func->params) {
+            if (param->base->get_cast() == t_struct)
+                return;
+        }
+        inline_scan_t scan;
+        scan.params = &func->params;
+        std::vector<sym_t::ref> exps;
+        for (size_t i = 0; i < body.size(); ++i) {
+            auto& s = body[i];
+            if (s->get_type() == s_ctrl) {
+                auto ctrl = std::dynamic_pointer_cast<sym_ctrl_t>(s);
+                if (AST_IS_KEYWORD_K(ctrl->op, k_interrupt)) {
+                    scan.size++;
+                    scan.effects = true;
+                    exps.push_back(s);
+                }
+                else if (AST_IS_KEYWORD_K(ctrl->op, k_return) && i + 1 == body.size()) {
+                    if (ctrl->exp) { // 只保留返回值，不引用ctrl以免与函数循环引用
+                        inline_scan(ctrl->exp, scan);
+                        exps.push_back(ctrl->exp);
+                    }
+                }
+                else {
+                    return;
+                }
+            }
+            else if (s->get_base_type() == s_expression) {
+                inline_scan(s, scan);
+                exps.push_back(s);
+            }
+            else {
+                return;
+            }
+        }
+        if (!scan.ok || scan.size > CGEN_INLINE_SIZE)
+            return;
+        auto ordered = scan.ordered && scan.uses.size() == func->params.size();
+        for (size_t i = 0; ordered && i < scan.uses.size(); ++i) {
+            ordered = scan.uses[i] == (int)i;
+        }
+        for (auto& s : exps) {
+            inline_detach(s);
+        }
+        func->inline_body = std::move(exps);
+        func->inline_ok = true;
+        func->inline_ordered = ordered;
+#if LOG_TYPE
+        std::cout << "[DEBUG] Inline: " << func->to_string() << std::endl;
+#endif
+    }
+
+    void cgen::inline_detach(const sym_t::ref & s) {
+        switch (s->get_type()) {
+        case s_var:
+        case s_var_id: {
+            auto var = std::dynamic_pointer_cast<sym_var_t>(s);
+            var->node = inline_node(var->node);
+        }
+                       break;
+        case s_cast:
+            inline_detach(std::dynamic_pointer_cast<sym_cast_t>(s)->exp);
+            break;
+        case s_unop: {
+            auto unop = std::dynamic_pointer_cast<sym_unop_t>(s);
+            unop->op = inline_node(unop->op);
+            inline_detach(unop->exp);
+        }
+                     break;
+        case s_binop: {
+            auto binop = std::dynamic_pointer_cast<sym_binop_t>(s);
+            binop->op = inline_node(binop->op);
+            inline_detach(binop->exp1);
+            inline_detach(binop->exp2);
+        }
+                      break;
+        case s_ctrl: {
+            auto ctrl = std::dynamic_pointer_cast<sym_ctrl_t>(s);
+            ctrl->op = inline_node(ctrl->op);
+            if (ctrl->exp)
+                inline_detach(ctrl->exp);
+        }
+                     break;
+        default:
+            break;
+        }
+    }
+
+    ast_node* cgen::inline_node(ast_node * node) {
+        // 语法树在编译结束后释放，导出的函数体需复制结点到符号分配区
+        auto n = arena->alloc<ast_node>();
+        *n = *node;
+        n->parent = n->prev = n->next = n->child = nullptr;
+        if (n->flag == ast_string || n->flag == ast_literal) {
+            auto len = strlen(node->data._string);
+            auto s = arena->alloc_array<char>(len + 1);
+            memcpy(s, node->data._string, len + 1);
+            n->data._string = s;
+        }
+        return n;
+    }
+#endif
+
     void cgen::gen_rec(ast_node * node, int level) {
         if (node == nullptr)
             return;
@@ -1728,13 +2992,12 @@ namespace clib {
             break;
         case c_structDeclarationList: {
             auto name = (ast.rbegin() + 1)->back();
-            auto & sym = symbols[0];
-            auto f = sym.find(name->data._string);
-            if (f != sym.end()) {
+            auto f = symbols.find_global(name->data._string);
+            if (f) {
                 if (ctx.lock()) {
                     ctx_stack.push_back(ctx.lock());
                 }
-                ctx = f->second;
+                ctx = f;
             }
             else {
                 error("invalid struct/union name");
@@ -1805,10 +3068,14 @@ namespace clib {
         }
                                  break;
         case c_compoundStatement:
-            symbols.emplace_back();
+            symbols.push();
             break;
         case c_blockItemList:
+#if CGEN_OPT
+            return gen_block(nodes, level);
+#else
             break;
+#endif
         case c_blockItem:
             break;
         case c_expressionStatement:
@@ -1832,7 +3099,7 @@ namespace clib {
             break;
         case c_functionDefinition:
         case c_structOrUnionSpecifier:
-            symbols.emplace_back();
+            symbols.push();
             break;
         case c_declarationList:
             break;
@@ -1862,28 +3129,28 @@ namespace clib {
                     auto& a = nodes[i];
                     if (AST_IS_OP(a)) {
                         if (AST_IS_OP_K(a, op_plus_plus) || AST_IS_OP_K(a, op_minus_minus)) {
-                            exp = std::make_shared<sym_sinop_t>(exp, a);
+                            exp = make_sym<sym_sinop_t>(exp, a);
                         }
                         else if (AST_IS_OP_K(a, op_dot) || AST_IS_OP_K(a, op_pointer)) {
                             ++i;
                             auto exp2 = primary_node(nodes[i]);
-                            exp = std::make_shared<sym_binop_t>(exp, exp2, a);
+                            exp = make_sym<sym_binop_t>(exp, exp2, a);
                         }
                         else if (AST_IS_OP_K(a, op_lsquare)) {
                             ++i;
                             auto exp2 = to_exp(tmp.back()[tmp_i++]);
-                            exp = std::make_shared<sym_binop_t>(exp, exp2, a);
+                            exp = make_sym<sym_binop_t>(exp, exp2, a);
                         }
                         else if (AST_IS_OP_K(a, op_lparan)) {
                             ++i;
                             if (!AST_IS_OP_K(nodes[i], op_rparan)) {
-                                exp = std::make_shared<sym_binop_t>(exp,
+                                exp = make_sym<sym_binop_t>(exp,
                                     to_exp(tmp.back()[tmp_i++]), a);
                                 ++i;
                             }
                             else {
-                                auto exp2 = std::make_shared<sym_list_t>();
-                                exp = std::make_shared<sym_binop_t>(exp, exp2, a);
+                                auto exp2 = make_sym<sym_list_t>();
+                                exp = make_sym<sym_binop_t>(exp, exp2, a);
                             }
                         }
                         else {
@@ -1901,7 +3168,7 @@ namespace clib {
         }
                                   break;
         case c_argumentExpressionList: {
-            auto list = std::make_shared<sym_list_t>();
+            auto list = make_sym<sym_list_t>();
             for (auto& _t : tmp.back()) {
                 list->exps.push_back(to_exp(_t));
             }
@@ -1925,7 +3192,7 @@ namespace clib {
                     auto& _exp = tmp.back().back();
                     auto exp = to_exp(_exp);
                     tmp.back().clear();
-                    auto unop = std::make_shared<sym_unop_t>(exp, op);
+                    auto unop = fold(make_sym<sym_unop_t>(exp, op));
                     tmp.back().push_back(unop);
                     asts.clear();
                 }
@@ -1938,14 +3205,14 @@ namespace clib {
             else if (AST_IS_KEYWORD_N(op, k_sizeof)) {
                 auto type = tmp.back().front();
                 if (type->get_base_type() == s_type) {
-                    auto exp = std::make_shared<type_exp_t>(std::dynamic_pointer_cast<type_t>(type));
-                    auto s = std::make_shared<sym_unop_t>(exp, op);
+                    auto exp = make_sym<type_exp_t>(std::dynamic_pointer_cast<type_t>(type));
+                    auto s = fold(make_sym<sym_unop_t>(exp, op));
                     tmp.back().clear();
                     tmp.back().push_back(s);
                 }
                 else {
                     auto exp = to_exp(type);
-                    auto s = std::make_shared<sym_unop_t>(exp, op);
+                    auto s = fold(make_sym<sym_unop_t>(exp, op));
                     tmp.back().clear();
                     tmp.back().push_back(s);
                 }
@@ -1962,7 +3229,7 @@ namespace clib {
             assert(tmp.back().front()->get_base_type() == s_type);
             auto type = std::dynamic_pointer_cast<type_t>(tmp.back().front());
             auto exp = to_exp(tmp.back().back());
-            auto cast = std::make_shared<sym_cast_t>(exp, type);
+            auto cast = fold(make_sym<sym_cast_t>(exp, type));
             tmp.back().clear();
             tmp.back().push_back(cast);
         }
@@ -1987,13 +3254,13 @@ namespace clib {
                     if (node->data._coll == c_conditionalExpression &&
                         AST_IS_OP_K(a, op_query)) { // triop
                         auto exp3 = to_exp(tmp.back()[tmp_i++]);
-                        exp1 = std::make_shared<sym_triop_t>(exp1, exp2, exp3, a, asts[i + 1]);
+                        exp1 = fold(make_sym<sym_triop_t>(exp1, exp2, exp3, a, asts[i + 1]));
                         if (tmp_i < tmp.back().size())
                             exp2 = to_exp(tmp.back()[tmp_i++]);
                         i++;
                     }
                     else { // binop
-                        exp1 = std::make_shared<sym_binop_t>(exp1, exp2, a);
+                        exp1 = fold(make_sym<sym_binop_t>(exp1, exp2, a));
                         if (tmp_i < tmp.back().size())
                             exp2 = to_exp(tmp.back()[tmp_i++]);
                     }
@@ -2011,7 +3278,7 @@ namespace clib {
             auto tmp_i = 0;
             auto exp1 = to_exp(tmp.back()[tmp_i++]);
             auto exp2 = to_exp(tmp.back()[tmp_i++]);
-            auto exp = std::make_shared<sym_binop_t>(exp1, exp2, asts.front());
+            auto exp = fold(make_sym<sym_binop_t>(exp1, exp2, asts.front()));
             tmp.back().clear();
             tmp.back().push_back(exp);
             asts.clear();
@@ -2029,11 +3296,11 @@ namespace clib {
         case c_specifierQualifierList: {
             type_t::ref base_type;
             if (AST_IS_KEYWORD_N(asts[0], k_struct) || AST_IS_KEYWORD_K(asts[0], k_union)) {
-                auto f = symbols[0].find(asts[1]->data._string);
-                if (f == symbols[0].end()) {
+                auto f = symbols.find_global(asts[1]->data._string);
+                if (!f) {
                     error("missing struct type");
                 }
-                auto s = std::dynamic_pointer_cast<sym_struct_t>(f->second);
+                auto s = std::dynamic_pointer_cast<sym_struct_t>(f);
                 if (s->get_type() != s_struct) {
                     error("need struct type");
                 }
@@ -2049,13 +3316,12 @@ namespace clib {
                 if (AST_IS_OP_N(asts[ast_i], op_lbrace))
                     ast_i++;
                 auto clazz = ctx.lock() ? z_local_var : z_global_var;
-                auto& s = symbols.back();
                 auto& _tmp = tmp.back();
                 ast_node zero;
                 zero.flag = ast_int;
                 zero.data._int = 0;
-                auto init_type = std::make_shared<type_base_t>(l_int, 0);
-                type_exp_t::ref init = std::make_shared<sym_var_t>(init_type, &zero);
+                auto init_type = make_sym<type_base_t>(l_int, 0);
+                type_exp_t::ref init = make_sym<sym_var_t>(init_type, &zero);
                 auto delta = -1;
                 for (size_t i = ast_i; i < asts.size(); ++i) {
                     auto& a = asts[i];
@@ -2067,8 +3333,8 @@ namespace clib {
                         else {
                             delta++;
                         }
-                        if (s.find(a->data._string) == s.end()) {
-                            auto type = std::make_shared<type_base_t>(l_int, 0);
+                        if (!symbols.find_scope(a->data._string)) {
+                            auto type = make_sym<type_base_t>(l_int, 0);
                             add_id(type, clazz, a, init, delta);
                         }
                         else {
@@ -2078,12 +3344,12 @@ namespace clib {
                 }
                 asts.clear();
                 _tmp.clear();
-                _tmp.push_back(std::make_shared<type_base_t>(l_int, 0));
+                _tmp.push_back(make_sym<type_base_t>(l_int, 0));
                 break;
             }
             if (AST_IS_KEYWORD_N(asts[0], k_unsigned)) { // unsigned ...
                 if (asts.size() == 1 || (asts.size() > 1 && !AST_IS_KEYWORD(asts[1]))) {
-                    base_type = std::make_shared<type_base_t>(l_uint);
+                    base_type = make_sym<type_base_t>(l_uint);
                     base_type->line = asts[0]->line;
                     base_type->column = asts[0]->column;
                     asts.erase(asts.begin());
@@ -2108,7 +3374,7 @@ namespace clib {
                         error(asts[1], "invalid unsigned * get_type");
                         break;
                     }
-                    base_type = std::make_shared<type_base_t>(type);
+                    base_type = make_sym<type_base_t>(type);
                     base_type->line = asts[0]->line;
                     base_type->column = asts[0]->column;
                     asts.erase(asts.begin());
@@ -2143,20 +3409,18 @@ namespace clib {
                     break;
                 }
                 if (type != l_none) {
-                    base_type = std::make_shared<type_base_t>(type);
+                    base_type = make_sym<type_base_t>(type);
                     base_type->line = asts[0]->line;
                     base_type->column = asts[0]->column;
                     asts.erase(asts.begin());
                 }
                 else {
                     if (AST_IS_ID(asts[0])) {
-                        auto& sym = symbols[0];
-                        auto f = sym.find(asts[0]->data._string);
-                        if (f != sym.end()) {
-                            auto& typedef_name = f->second;
+                        auto typedef_name = symbols.find_global(asts[0]->data._string);
+                        if (typedef_name) {
                             auto t = typedef_name->get_base_type();
                             if (t == s_type || t == s_struct || t == s_function) {
-                                base_type = std::make_shared<type_typedef_t>(typedef_name);
+                                base_type = make_sym<type_typedef_t>(typedef_name);
                                 base_type->line = asts[0]->line;
                                 base_type->column = asts[0]->column;
                                 asts.erase(asts.begin());
@@ -2218,7 +3482,7 @@ namespace clib {
                     type = std::dynamic_pointer_cast<type_t>(t);
                 }
                 else {
-                    type = std::make_shared<type_typedef_t>(t);
+                    type = make_sym<type_typedef_t>(t);
                 }
             }
             auto ptr = 0;
@@ -2310,19 +3574,19 @@ namespace clib {
                     }
                     type->ptr = children.size();
                 }
-                auto func = std::make_shared<sym_func_t>(type, nodes[0]->data._string);
+                auto func = make_sym<sym_func_t>(type, nodes[0]->data._string);
                 ctx = func;
                 func->clazz = z_function;
                 func->addr = text.size();
                 {
-                    auto f = symbols[0].find(func->get_name());
-                    if (f != symbols[0].end()) {
-                        if (f->second->get_type() == s_function) {
+                    auto f = symbols.find_global(func->get_name());
+                    if (f) {
+                        if (f->get_type() == s_function) {
                             error(nodes[0], "conflict id with function: " + func->to_string());
                         }
                     }
                 }
-                symbols[0].insert(std::make_pair(nodes[0]->data._string, func));
+                symbols.insert_global(nodes[0]->data._string, func);
                 std::unordered_set<string_t> ids;
                 auto ptr = 0;
                 for (size_t i = 2, j = 0; i < asts.size() && j < tmp.size(); ++i) {
@@ -2331,7 +3595,7 @@ namespace clib {
                         const auto& pt = std::dynamic_pointer_cast<type_t>(tmp.back()[j]);
                         pt->ptr = ptr;
                         auto& name = pa->data._string;
-                        auto id = std::make_shared<sym_id_t>(pt, name);
+                        auto id = make_sym<sym_id_t>(pt, name);
                         id->line = pa->line;
                         id->column = pa->column;
                         id->clazz = z_param_var;
@@ -2341,9 +3605,9 @@ namespace clib {
                             error(id, "conflict id: " + id->to_string());
                         }
                         {
-                            auto f = symbols[0].find(pa->data._string);
-                            if (f != symbols[0].end()) {
-                                if (f->second->get_type() == s_function) {
+                            auto f = symbols.find_global(pa->data._string);
+                            if (f) {
+                                if (f->get_type() == s_function) {
                                     error(id, "conflict argument in function: " + id->to_string());
                                 }
                             }
@@ -2371,8 +3635,20 @@ namespace clib {
 #endif
                 if (has_impl) {
                     tmp.back().push_back(func);
-                    emit(ENT, 0);
-                    func->entry = text.size() - 1;
+                    auto locals = false, pushes = false;
+                    gen_frame_scan(node->parent->parent->child, locals, func->frame_escape, pushes);
+                    func->frameless = func->params.empty() && !locals && !pushes;
+                    if (func->frameless) {
+                        func->entry = -1;
+                    }
+                    else {
+                        emit(ENT, 0);
+                        func->entry = text.size() - 1;
+                    }
+#if CGEN_INLINE
+                    inline_body.clear();
+                    inline_collect = gen_inline_scan(gen_get_children(node->parent->parent->child).back()->child);
+#endif
                 }
                 else {
                     ctx.reset();
@@ -2436,6 +3712,10 @@ namespace clib {
                 for (auto& _t : tmp.back()) {
                     _t->gen_rvalue(*this);
                 }
+#if CGEN_INLINE
+                if (inline_collect)
+                    std::copy(tmp.back().begin(), tmp.back().end(), std::back_inserter(inline_body));
+#endif
             }
         }
                           break;
@@ -2456,7 +3736,7 @@ namespace clib {
         }
                                  break;
         case c_compoundStatement: {
-            symbols.pop_back();
+            symbols.pop();
             tmp.back().clear();
         }
                                   break;
@@ -2490,26 +3770,28 @@ namespace clib {
                             error(a, "return requires  ", true);
                         }
                         auto _exp = std::dynamic_pointer_cast<type_exp_t>(exp);
-                        auto ctrl = std::make_shared<sym_ctrl_t>(a);
+                        auto ctrl = make_sym<sym_ctrl_t>(a);
                         ctrl->exp = _exp;
+                        ctrl->func = std::dynamic_pointer_cast<sym_func_t>(ctx.lock());
                         tmp.back().clear();
                         tmp.back().push_back(ctrl);
                         asts.clear();
                     }
                     else {
-                        auto ctrl = std::make_shared<sym_ctrl_t>(a);
+                        auto ctrl = make_sym<sym_ctrl_t>(a);
+                        ctrl->func = std::dynamic_pointer_cast<sym_func_t>(ctx.lock());
                         tmp.back().clear();
                         tmp.back().push_back(ctrl);
                         asts.clear();
                     }
                 }
                 else if (AST_IS_KEYWORD_K(a, k_break) || AST_IS_KEYWORD_K(a, k_continue)) {
-                    auto ctrl = std::make_shared<sym_ctrl_t>(a);
+                    auto ctrl = make_sym<sym_ctrl_t>(a);
                     tmp.back().push_back(ctrl);
                     asts.clear();
                 }
                 else if (AST_IS_KEYWORD_K(a, k_interrupt)) {
-                    auto ctrl = std::make_shared<sym_ctrl_t>(a);
+                    auto ctrl = make_sym<sym_ctrl_t>(a);
                     auto number = primary_node(asts[1]);
                     ctrl->exp = number;
                     tmp.back().push_back(ctrl);
@@ -2534,10 +3816,15 @@ namespace clib {
         }
                                     break;
         case c_functionDefinition: {
+            auto func = std::dynamic_pointer_cast<sym_func_t>(ctx.lock());
+#if CGEN_INLINE
+            if (func)
+                inline_func(func);
+#endif
             ctx_stack.clear();
             ctx.reset();
-            symbols.pop_back();
-            emit(LEV);
+            symbols.pop();
+            emit(func && func->frameless ? RET : LEV);
         }
                                    break;
         case c_structOrUnionSpecifier: {
@@ -2547,7 +3834,7 @@ namespace clib {
                 ctx = ctx_stack.back();
                 ctx_stack.pop_back();
             }
-            symbols.pop_back();
+            symbols.pop();
         }
                                        break;
         case c_declarationList:
@@ -2555,6 +3842,21 @@ namespace clib {
         }
     }
 
+    // 循环条件，不成立时跳转到L
+    void cgen::gen_cond(const type_exp_t::ref & exp, int L) {
+#if CGEN_OPT
+        auto cond = opt_truth(exp);
+        if (cond == 1) // 恒真，省去判断
+            return;
+        if (cond == 0) { // 恒假，直接跳出
+            emit(JMP, L);
+            return;
+        }
+#endif
+        exp->gen_rvalue(*this);
+        emit(JZ, L); // jump break
+    }
+
     void cgen::gen_stmt(const std::vector<ast_node*> & nodes, int level, ast_node * node) {
         auto& k = nodes[0];
         if (AST_IS_KEYWORD_K(k, k_if)) {
@@ -2563,6 +3865,20 @@ namespace clib {
             tmp.back().clear();
 #if LOG_TYPE
             std::cout << "[DEBUG] If: " << exp->to_string() << std::endl;
+#endif
+#if CGEN_OPT
+            auto cond = opt_truth(exp);
+            if (cond == 1 && (nodes.size() < 4 || !ast_has_label(nodes[4]))) { // 只生成真分支
+                gen_rec(nodes[2], level);
+                tmp.back().clear();
+                return;
+            }
+            if (cond == 0 && !ast_has_label(nodes[2])) { // 只生成假分支
+                if (nodes.size() >= 4)
+                    gen_rec(nodes[4], level);
+                tmp.back().clear();
+                return;
+            }
 #endif
             exp->gen_rvalue(*this);
             emit(JZ, -1);
@@ -2593,8 +3909,7 @@ namespace clib {
             auto L1 = (int)text.size(); // break
             emit(JMP, -1);
             auto L2 = (int)text.size(); // continue
-            exp->gen_rvalue(*this);
-            emit(JZ, L1); // jump break
+            gen_cond(exp, L1);
             cycle_t c{ L1, L2 };
             cycle.push_back(c);
             gen_rec(_stmt, level); // stmt
@@ -2634,8 +3949,7 @@ namespace clib {
 #if LOG_TYPE
                 std::cout << "[DEBUG] For: cond= " << sym_to_string(_cond_exp[1]) << std::endl;
 #endif
-                _cond_exp[1]->gen_rvalue(*this);
-                emit(JZ, L1); // jump break
+                gen_cond(std::dynamic_pointer_cast<type_exp_t>(_cond_exp[1]), L1);
             }
             cycle_t c{ L1, L2 };
             cycle.push_back(c);
@@ -2664,8 +3978,7 @@ namespace clib {
             auto L1 = (int)text.size(); // break
             emit(JMP, -1);
             auto L2 = (int)text.size(); // continue
-            exp->gen_rvalue(*this);
-            emit(JZ, L1); // jump break
+            gen_cond(exp, L1);
             cycle_t c{ L1, L2 };
             cycle.push_back(c);
             text[L1 - 1] = (int)text.size();
@@ -2701,22 +4014,25 @@ namespace clib {
             auto _default = -1;
             auto & _cases = cases.back();
             for (size_t i = 0; i < _cases.size(); ++i) {
-                auto& _c = _cases[i];
-                if (_c._case) {
-                    _c._case->gen_rvalue(*this);
-                    emit(CASE);
-                    emit(JZ, _c.addr);
-                }
-                else if (_default == -1) {
+                if (!_cases[i]._case) {
+                    if (_default != -1)
+                        error(k, "conflict default: ", true);
                     _default = i;
                 }
-                else {
-                    error(k, "conflict default: ", true);
-                }
             }
-            emit(POP, c2);
-            if (_default != -1) {
-                emit(JMP, _cases[_default].addr);
+            if (c2 != 4 || exp->base->get_cast() > t_uint ||
+                !gen_switch_table(k, _cases, _default)) {
+                for (auto& _c : _cases) {
+                    if (_c._case) {
+                        _c._case->gen_rvalue(*this);
+                        emit(CASE);
+                        emit(JZ, _c.addr);
+                    }
+                }
+                emit(POP, c2);
+                if (_default != -1) {
+                    emit(JMP, _cases[_default].addr);
+                }
             }
             text[L1 + 1] = text.size(); // jump break
             tmp.back().clear();
@@ -2782,8 +4098,15 @@ namespace clib {
                     if (_id->get_type() != s_id)
                         error(id, "allocate: invalid init value");
                     auto var2 = std::dynamic_pointer_cast<sym_id_t>(_id);
-                    std::copy(data.data() + var2->addr,
-                        data.data() + var2->addr_end,
+                    auto src = data.data();
+                    if (!var2->unit.empty()) { // 初值来自其他单元
+                        auto f = imports.find(var2->unit);
+                        if (f == imports.end())
+                            error(id, "allocate: unresolved unit " + var2->unit);
+                        src = f->second->data.data();
+                    }
+                    std::copy(src + var2->addr,
+                        src + var2->addr_end,
                         std::back_inserter(data));
                     if (delta > 0) {
                         *(((int*)(data.data() + data.size())) - 1) += delta;
@@ -2921,6 +4244,8 @@ namespace clib {
         else if (id->clazz == z_local_var) {
             auto size = align4(type->size(x_size));
             auto func = std::dynamic_pointer_cast<sym_func_t>(ctx.lock());
+            if (func->frameless)
+                error(id, "allocate: local in frameless function");
             func->ebp_local += size;
             text[func->entry] += size;
             id->addr = func->ebp - func->ebp_local;
@@ -3004,7 +4329,7 @@ namespace clib {
     sym_id_t::ref cgen::add_id(const type_base_t::ref & type, sym_class_t clazz,
         ast_node * node, const type_exp_t::ref & init, int delta) {
         assert(AST_IS_ID(node));
-        auto new_id = std::make_shared<sym_id_t>(type, node->data._string);
+        auto new_id = make_sym<sym_id_t>(type, node->data._string);
         new_id->line = node->line;
         new_id->column = node->column;
         new_id->clazz = clazz;
@@ -3017,13 +4342,13 @@ namespace clib {
 #if LOG_TYPE
         std::cout << "[DEBUG] Id: " << new_id->to_string() << std::endl;
 #endif
-        if (!symbols.back().insert(std::make_pair(node->data._string, new_id)).second) {
+        if (!symbols.insert(node->data._string, new_id)) {
             error(new_id, "conflict id: " + new_id->to_string());
         }
-        if (symbols.size() > 1) {
-            auto f = symbols[0].find(node->data._string);
-            if (f != symbols[0].end()) {
-                if (f->second->get_type() == s_function) {
+        if (symbols.level() > 0) {
+            auto f = symbols.find_global(node->data._string);
+            if (f) {
+                if (f->get_type() == s_function) {
                     error(new_id, "conflict id with function: " + new_id->to_string());
                 }
             }
@@ -3032,11 +4357,9 @@ namespace clib {
     }
 
     sym_t::ref cgen::find_symbol(const string_t & name) {
-        for (auto s = symbols.rbegin(); s != symbols.rend(); s++) {
-            auto f = s->find(name);
-            if (f != s->end()) {
-                return f->second;
-            }
+        auto f = symbols.find(name);
+        if (f) {
+            return f;
         }
         if (ctx.lock()) {
             auto _ctx = ctx.lock();
@@ -3058,28 +4381,28 @@ namespace clib {
         case ast_literal: {
             if (AST_IS_COLL_N(node->parent, c_postfixExpression) &&
                 (AST_IS_OP_N(node->prev, op_dot) || AST_IS_OP_N(node->prev, op_pointer))) {
-                t = std::make_shared<type_base_t>(l_int, 0);
-                return std::make_shared<sym_var_t>(t, node);
+                t = make_sym<type_base_t>(l_int, 0);
+                return make_sym<sym_var_t>(t, node);
             }
             auto sym = find_symbol(node->data._string);
             if (!sym)
                 error(node, "undefined id: " + string_t(node->data._string));
             if (sym->get_type() == s_id || sym->get_type() == s_function) {
                 t = std::dynamic_pointer_cast<sym_id_t>(sym)->base->clone();
-                return std::make_shared<sym_var_id_t>(t, node, sym);
+                return make_sym<sym_var_id_t>(t, node, sym);
             }
             if (sym->get_type() == s_struct) {
                 t = std::dynamic_pointer_cast<type_typedef_t>(sym);
-                return std::make_shared<sym_var_id_t>(t, node, sym);
+                return make_sym<sym_var_id_t>(t, node, sym);
             }
             error(node, "required id but got: " + sym->to_string());
         }
         case ast_string:
-            t = std::make_shared<type_base_t>(l_char, 1);
+            t = make_sym<type_base_t>(l_char, 1);
             break;
 #define DEF_LEX(name) \
             case ast_##name: \
-                t = std::make_shared<type_base_t>(l_##name, 0); \
+                t = make_sym<type_base_t>(l_##name, 0); \
                 break;
             DEF_LEX(char);
             DEF_LEX(uchar);
@@ -3094,7 +4417,7 @@ namespace clib {
 #undef DEF_LEX
         case ast_keyword: {
             if (AST_IS_KEYWORD_K(node, k_true) || AST_IS_KEYWORD_K(node, k_false))
-                t = std::make_shared<type_base_t>(l_int, 0);
+                t = make_sym<type_base_t>(l_int, 0);
             else
                 error(node, "invalid var keyword type: ", true);
         }
@@ -3103,7 +4426,7 @@ namespace clib {
             error(node, "invalid var type: ", true);
             break;
         }
-        return std::make_shared<sym_var_t>(t, node);
+        return make_sym<sym_var_t>(t, node);
     }
 
     std::tuple<sym_class_t, string_t> sym_class_string_list[] = {
@@ -3134,23 +4457,22 @@ namespace clib {
                     if (AST_IS_ID(node->child->next)) {
                         auto _struct = node->child->child->data._keyword;
                         auto id = node->child->next->data._string;
-                        auto& sym = symbols[0];
-                        if (sym.find(id) != sym.end()) {
+                        if (symbols.find_global(id)) {
                             // CONFLICT STRUCT DECLARATION
                             return b_fail;
                         }
-                        sym.insert(std::make_pair(id, std::make_shared<sym_struct_t>(_struct == k_struct, id)));
+                        symbols.insert_global(id, make_sym<sym_struct_t>(_struct == k_struct, id));
+                        checked.push_back(id);
                     }
                 }
                                                break;
                 case c_typedefName: { // READONLY
                     if (AST_IS_ID(node->child)) {
                         auto id = node->child->next->data._string;
-                        auto& sym = symbols[0];
-                        auto f = sym.find(id);
-                        if (f != sym.end()) {
-                            auto t = f->second->get_base_type();
-                            if (t == s_type || t == s_struct || t == s_function)
+                        auto f = symbols.find_global(id);
+                        if (f) {
+                            auto t = f->get_base_type();
+                            if (t == s_type || t == s_struct) // 导入的函数不是类型名
                                 return b_next;
                         }
                         return b_error;
@@ -3164,4 +4486,24 @@ namespace clib {
         }
         return b_next;
     }
+
+    void cgen::snapshot() {
+        checked.clear();
+    }
+
+    void cgen::restore() {
+        for (auto& id : checked) {
+            symbols.erase_global(id);
+        }
+        checked.clear();
+    }
+
+    bool cgen::is_type(const string_t & id) {
+        auto f = symbols.find_global(id);
+        if (f) {
+            auto t = f->get_base_type();
+            return t == s_type || t == s_struct;
+        }
+        return false;
+    }
 }
@@ -8,10 +8,24 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include "cast.h"
 #include "cparser.h"
 #include "cvm.h"
 
+// 代码生成或指令集变化时递增，使持久化的编译缓存失效
+#define CGEN_VERSION 7
+
+#define SYM_ARENA_CHUNK (64 * 1024)
+
+#define CGEN_OPT 1 // 常量折叠、强度削减及不可达代码消除，调试时置0
+
+#define CGEN_INLINE 1 // 小函数在调用处内联展开
+#define CGEN_INLINE_SIZE 16 // 可内联函数体的最大结点数
+
+// 编译缓存的版本号，含优化开关，切换开关后不会载入另一配置生成的缓存
+#define CGEN_CONFIG ((CGEN_VERSION << 16) | (CGEN_OPT << 12) | (CGEN_INLINE << 8) | (CGEN_INLINE ? CGEN_INLINE_SIZE & 0xff : 0))
+
 namespace clib {
 
     enum symbol_t {
@@ -51,14 +65,26 @@ namespace clib {
         t_error,
     };
 
+    // CAST指令操作数上限，对应cast_find转换矩阵中最大编号 (double转float)
+#define CAST_OP_MAX 38
+
     enum gen_t {
         g_ok,
         g_error,
         g_no_load,
     };
 
+    enum reloc_t {
+        r_text, // 代码地址
+        r_data, // 数据地址
+    };
+
+    class sym_t;
+    class type_exp_t;
+
     class igen {
     public:
+        using bind_t = std::unordered_map<const sym_t*, std::shared_ptr<type_exp_t>>; // 形参 -> 实参
         virtual void emit(ins_t) = 0;
         virtual void emit(ins_t, int) = 0;
         virtual void emit(ins_t, int, int) = 0;
@@ -66,6 +92,11 @@ namespace clib {
         virtual int current() const = 0;
         virtual void edit(int, int) = 0;
         virtual int load_string(const string_t&) = 0;
+        virtual void reloc(reloc_t, const string_t& unit) = 0;
+        virtual void inlined(const string_t& name, int line, int column) = 0;
+        virtual void bind(const bind_t& args) = 0;
+        virtual void unbind() = 0;
+        virtual std::shared_ptr<type_exp_t> bound(const sym_t* param) const = 0;
         virtual void error(const string_t&) const = 0;
     };
 
@@ -161,12 +192,14 @@ namespace clib {
         gen_t gen_lvalue(igen& gen) override;
         gen_t gen_rvalue(igen& gen) override;
         cast_t get_cast() const override;
+        gen_t gen_bind(igen& gen, const type_exp_t::ref& exp);
         type_t::ref base;
         type_exp_t::ref init;
         string_t id;
         sym_class_t clazz{ z_undefined };
         int addr{ 0 };
         int addr_end{ 0 };
+        string_t unit; // 所在目标单元，空为当前单元
     };
 
     class sym_struct_t : public sym_t {
@@ -194,9 +227,18 @@ namespace clib {
         string_t to_string() const override;
         gen_t gen_invoke(igen& gen, sym_t::ref& list) override;
         cast_t get_cast() const override;
+        int gen_args(igen& gen, sym_t::ref& list);
+        int args_size() const;
+        bool can_inline(const sym_t::ref& list) const;
+        bool gen_inline(igen& gen, sym_t::ref& list, const sym_t& site);
         std::vector<sym_id_t::ref> params;
         int ebp{ 0 }, ebp_local{ 0 };
         int entry{ 0 };
+        bool frameless{ false }; // 无参数无局部变量，省略ENT/LEV
+        bool frame_escape{ false }; // 栈帧地址可能外泄，不做尾调用
+        std::vector<sym_t::ref> inline_body; // 内联展开用的函数体
+        bool inline_ok{ false };
+        bool inline_ordered{ false }; // 形参按序各引用一次，实参可有副作用
     };
 
     class sym_var_t : public type_exp_t {
@@ -321,8 +363,76 @@ namespace clib {
         string_t to_string() const override;
         gen_t gen_lvalue(igen& gen) override;
         gen_t gen_rvalue(igen& gen) override;
+        bool gen_tail(igen& gen);
         type_exp_t::ref exp;
         ast_node* op{ nullptr };
+        std::shared_ptr<sym_func_t> func;
+    };
+
+    // 符号分配区，符号与引用计数块一并分配，最后一个引用释放时整体回收
+    using sym_arena = memory_arena<SYM_ARENA_CHUNK>;
+
+    template<class T>
+    struct sym_allocator {
+        using value_type = T;
+        explicit sym_allocator(const std::shared_ptr<sym_arena>& arena) : arena(arena) {}
+        template<class U>
+        sym_allocator(const sym_allocator<U>& a) : arena(a.arena) {}
+        T* allocate(size_t n) {
+            return arena->alloc_array<T>(n);
+        }
+        void deallocate(T*, size_t) {}
+        template<class U>
+        bool operator==(const sym_allocator<U>& a) const { return arena == a.arena; }
+        template<class U>
+        bool operator!=(const sym_allocator<U>& a) const { return arena != a.arena; }
+        std::shared_ptr<sym_arena> arena;
+    };
+
+    // 作用域符号表，标识符驻留为整数编号
+    // 全局符号按编号直接索引，局部符号记入撤销日志，退出作用域时回退到标记处
+    class sym_table {
+    public:
+        int intern(const string_t& name);
+        const string_t& name(int id) const;
+
+        void push();
+        void pop();
+        int level() const;
+
+        bool insert(const string_t& name, const sym_t::ref& sym); // 当前作用域
+        bool insert_global(const string_t& name, const sym_t::ref& sym);
+        void erase_global(const string_t& name);
+        sym_t::ref find(const string_t& name) const; // 由内向外
+        sym_t::ref find_scope(const string_t& name) const; // 仅当前作用域
+        sym_t::ref find_global(const string_t& name) const;
+
+        template<class F>
+        void for_each_global(F f) const {
+            for (size_t i = 0; i < globals.size(); ++i) {
+                if (globals[i])
+                    f(names[i], globals[i]);
+            }
+        }
+
+        void clear();
+
+    private:
+        int id_of(const string_t& name) const;
+
+    private:
+        struct entry_t {
+            int id;
+            int level;
+            int prev;
+            sym_t::ref sym;
+        };
+        std::unordered_map<string_t, int> ids;
+        std::vector<string_t> names;
+        std::vector<sym_t::ref> globals; // 编号 -> 全局符号
+        std::vector<int> heads; // 编号 -> 最内层局部符号所在日志下标
+        std::vector<entry_t> entries; // 局部符号撤销日志
+        std::vector<size_t> marks; // 各作用域起始日志下标
     };
 
     struct cycle_t {
@@ -330,6 +440,20 @@ namespace clib {
         int _continue;
     };
 
+    // 代码生成统计，reset时清零
+    struct cgen_stat_t {
+        int instructions{ 0 };
+        int symbols{ 0 }; // 分配的符号数
+        size_t symbol_bytes{ 0 };
+    };
+
+    struct inline_t {
+        string_t callee;
+        string_t caller;
+        int line;
+        int column;
+    };
+
     struct switch_t {
         type_exp_t::ref _case;
         int addr;
@@ -345,6 +469,24 @@ namespace clib {
         // byte *text;
     };
 
+    struct reloc_item_t {
+        int pos;
+        reloc_t type;
+        string_t unit;
+    };
+
+    // 可重定位目标单元
+    struct cobj_t {
+        using ref = std::shared_ptr<cobj_t>;
+        string_t path;
+        std::vector<LEX_T(int)> text;
+        std::vector<LEX_T(char)> data;
+        std::vector<reloc_item_t> relocs;
+        std::unordered_map<LEX_T(string), std::shared_ptr<sym_t>> symbols; // 导出符号
+        // 导出符号引用所在单元的整个符号分配区，对象存活期间分配区不释放
+        size_t retained{ 0 }; // 分配区大小，缓存按此限制总量
+    };
+
     // 生成虚拟机指令
     class cgen : public csemantic, public igen {
     public:
@@ -355,11 +497,18 @@ namespace clib {
         cgen& operator=(const cgen&) = delete;
 
         backtrace_direction check(pda_edge_t, ast_node*) override;
+        bool is_type(const string_t&) override;
+        void snapshot() override;
+        void restore() override;
 
         void gen(ast_node* node);
         void reset();
         std::vector<byte> file() const;
 
+        void import(const cobj_t::ref& obj);
+        cobj_t::ref object(const string_t& path);
+        std::vector<byte> link(const std::vector<cobj_t::ref>& objs) const;
+
         void emit(ins_t) override;
         void emit(ins_t, int) override;
         void emit(ins_t, int, int) override;
@@ -367,11 +516,25 @@ namespace clib {
         int current() const override;
         void edit(int, int) override;
         int load_string(const string_t&) override;
+        void reloc(reloc_t, const string_t& unit) override;
+        void inlined(const string_t& name, int line, int column) override;
+        void bind(const bind_t& args) override;
+        void unbind() override;
+        std::shared_ptr<type_exp_t> bound(const sym_t* param) const override;
         void error(const string_t&) const override;
+
+        const std::vector<inline_t>& get_inlines() const;
+        cgen_stat_t get_stat() const;
     private:
+        std::vector<byte> file(uint addr, const std::vector<LEX_T(char)>& _data, const std::vector<LEX_T(int)>& _text) const;
+
+        int load_table(const std::vector<int>& table);
+        bool gen_switch_table(ast_node* k, const std::vector<switch_t>& _cases, int _default);
+
         void gen_rec(ast_node* node, int level);
         void gen_coll(const std::vector<ast_node*>& nodes, int level, ast_node* node);
         void gen_stmt(const std::vector<ast_node*>& nodes, int level, ast_node* node);
+        void gen_cond(const type_exp_t::ref& exp, int L);
 
         void allocate(sym_id_t::ref id, const type_exp_t::ref& init, int delta = 0);
         sym_id_t::ref add_id(const type_base_t::ref&, sym_class_t, ast_node*, const type_exp_t::ref&, int = 0);
@@ -386,10 +549,29 @@ namespace clib {
 
         type_exp_t::ref to_exp(sym_t::ref s);
 
+        type_exp_t::ref fold(const type_exp_t::ref& exp);
+#if CGEN_OPT
+        ast_node* new_node(ast_t type, const sym_t::ref& pos);
+        type_exp_t::ref new_const(cast_t type, uint64 value, const sym_t::ref& pos);
+        void gen_block(const std::vector<ast_node*>& nodes, int level);
+#endif
+#if CGEN_INLINE
+        void inline_func(const std::shared_ptr<sym_func_t>& func);
+        void inline_detach(const sym_t::ref& s);
+        ast_node* inline_node(ast_node* node);
+#endif
+
+        template<class T, class... TArgs>
+        std::shared_ptr<T> make_sym(TArgs&&... args) {
+            sym_count++;
+            return std::allocate_shared<T>(sym_allocator<T>(arena), std::forward<TArgs>(args)...);
+        }
+
     private:
         std::vector<LEX_T(int)> text; // 代码
         std::vector<LEX_T(char)> data; // 数据
-        std::vector<std::unordered_map<LEX_T(string), std::shared_ptr<sym_t>>> symbols; // 符号表
+        std::shared_ptr<sym_arena> arena; // 符号分配区，导出的符号持有其引用
+        sym_table symbols; // 符号表
         std::vector<std::vector<ast_node*>> ast;
         std::vector<std::vector<sym_t::ref>> tmp;
         std::vector<cycle_t> cycle;
@@ -397,6 +579,15 @@ namespace clib {
         sym_t::weak_ref ctx;
         std::vector<sym_t::ref> ctx_stack;
         int global_id{ 0 };
+        std::vector<reloc_item_t> relocs; // 重定位表
+        std::unordered_map<string_t, cobj_t::ref> imports;
+        std::unordered_set<string_t> imported;
+        bool inline_collect{ false }; // 当前函数体是否为内联候选
+        std::vector<sym_t::ref> inline_body;
+        std::vector<inline_t> inlines; // 内联展开记录
+        std::vector<bind_t> binds; // 内联展开的实参绑定，栈顶为当前展开
+        std::vector<string_t> checked; // check中插入的全局结构体，供restore撤销
+        int sym_count{ 0 };
     };
 }
 
@@ -8,13 +8,16 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <chrono>
 #include "cgui.h"
 #include "cexception.h"
 #include "../../ui/gdi/Gdi.h"
 #include "Parser2D.h"
 
-#define LOG_AST 0
 #define LOG_DEP 0
+#define BENCH_LEXER 0 // 启动时测量词法分析吞吐量
+#define BENCH_LEXER_ROUNDS 20
 
 #define ENTRY_FILE "/sys/entry"
 
@@ -44,6 +47,13 @@ namespace clib {
         std::fill(colors_fg, colors_fg + size, color_fg);
         color_bg_stack.push_back(color_bg);
         color_fg_stack.push_back(color_fg);
+        watch_handle = FindFirstChangeNotificationA(FILE_ROOT, TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    }
+
+    cgui::~cgui() {
+        if (watch_handle != INVALID_HANDLE_VALUE)
+            FindCloseChangeNotification(watch_handle);
     }
 
     cgui& cgui::singleton() {
@@ -51,19 +61,78 @@ namespace clib {
         return gui;
     }
 
-    string_t cgui::load_file(string_t& name) {
+#if BENCH_LEXER || GUI_BENCH_COMPILER
+    static void bench_files(const string_t& dir, std::vector<string_t>& files) {
+        WIN32_FIND_DATAA fd;
+        auto h = FindFirstFileA((dir + "/*").c_str(), &fd);
+        if (h == INVALID_HANDLE_VALUE)
+            return;
+        do {
+            string_t name(fd.cFileName);
+            if (name == "." || name == "..")
+                continue;
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                bench_files(dir + "/" + name, files);
+            else
+                files.push_back(dir + "/" + name);
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+#endif
+
+#if BENCH_LEXER
+    // 拼接全部脚本源码，反复扫描，只计词法分析
+    static void bench_lexer() {
+        std::vector<string_t> files;
+        bench_files(FILE_ROOT, files);
+        std::stringstream ss;
+        for (auto& f : files) {
+            std::ifstream t(f, std::ios::binary);
+            ss << t.rdbuf() << '\n';
+        }
+        auto text = ss.str();
+        if (text.empty())
+            return;
+        auto tokens = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto i = 0; i < BENCH_LEXER_ROUNDS; i++) {
+            clexer lexer(text);
+            while (lexer.next() != l_end)
+                tokens++;
+        }
+        auto span = std::chrono::duration_cast<std::chrono::duration<decimal>>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        ATLTRACE("[SYSTEM] BENCH | Lexer: %d files, %d bytes, %d tokens, %.2f MB/s\n",
+            (int)files.size(), (int)text.length(), tokens / BENCH_LEXER_ROUNDS,
+            text.length() * BENCH_LEXER_ROUNDS / 1048576.0 / span);
+    }
+#endif
+
+    // 虚拟路径对应的宿主源文件，不合法时为空
+    static string_t source_file(const string_t& name) {
         static string_t pat_path{ R"((/[A-Za-z0-9_]+)+)" };
         static std::regex re_path(pat_path);
         static string_t pat_bin{ R"([A-Za-z0-9_]+)" };
         static std::regex re_bin(pat_bin);
         std::smatch res;
-        string_t path;
         if (std::regex_match(name, res, re_path)) {
-            path = FILE_ROOT + res[0].str() + ".cpp";
+            return FILE_ROOT + res[0].str() + ".cpp";
         }
-        else if (std::regex_match(name, res, re_bin)) {
-            path = FILE_ROOT + ("/bin/" + res[0].str()) + ".cpp";
+        if (std::regex_match(name, res, re_bin)) {
+            return FILE_ROOT + ("/bin/" + res[0].str()) + ".cpp";
         }
+        return "";
+    }
+
+    static uint64_t source_time(const string_t& file) {
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        if (file.empty() || !GetFileAttributesExA(file.c_str(), GetFileExInfoStandard, &fad))
+            return 0;
+        return (uint64_t)fad.ftLastWriteTime.dwHighDateTime << 32 | fad.ftLastWriteTime.dwLowDateTime;
+    }
+
+    string_t cgui::load_file(string_t& name) {
+        auto path = source_file(name);
         if (path.empty())
             error("file not exists: " + name);
         std::ifstream t(path);
@@ -106,19 +175,14 @@ namespace clib {
     void cgui::reset() {
         if (vm) {
             vm.reset();
-            gen.reset();
             running = false;
-            cvm::global_state.input_lock = -1;
-            cvm::global_state.input_content.clear();
-            cvm::global_state.input_waiting_list.clear();
-            cvm::global_state.input_read_ptr = -1;
-            cvm::global_state.input_success = false;
+            entry_pending = false;
         }
     }
 
     void cgui::draw(CComPtr<ID2D1RenderTarget>& rt, const CRect& bounds, const Parser2DEngine::BrushBag& brushes, bool paused, decimal fps) {
         if (!paused) {
-            if (cvm::global_state.interrupt) {
+            if (vm && vm->global_state.interrupt) {
                 cycle = GUI_CYCLES;
             }
             else if (cycle_set) {
@@ -249,6 +313,8 @@ namespace clib {
     void cgui::tick() {
         if (exited)
             return;
+        if (vm)
+            watch();
         if (running) {
             try {
                 if (!vm->run(cycle, cycles)) {
@@ -256,28 +322,44 @@ namespace clib {
                     exited = true;
                     put_string("\n[!] clibos exited.");
                     vm.reset();
-                    gen.reset();
                 }
             }
             catch (const cexception & e) {
                 ATLTRACE("[SYSTEM] ERR  | RUNTIME ERROR: %s\n", e.message().c_str());
                 vm.reset();
-                gen.reset();
                 running = false;
             }
         }
         else {
             if (!vm) {
-                vm = std::make_unique<cvm>();
-                std::vector<string_t> args;
+#if BENCH_LEXER
+                bench_lexer();
+#endif
+                vm = std::make_unique<cvm>(this);
+                vm->set_smp(GUI_SMP_WORKERS);
+#if GUI_BENCH_COMPILER
+                bench_compiler();
+#endif
+                entry_args.clear();
                 if (g_argc > 0) {
-                    args.emplace_back(ENTRY_FILE);
+                    entry_args.emplace_back(ENTRY_FILE);
                     for (int i = 1; i < g_argc; ++i) {
-                        args.emplace_back(g_argv[i]);
+                        entry_args.emplace_back(g_argv[i]);
                     }
                 }
-                if (compile(ENTRY_FILE, args) != -1) {
-                    running = true;
+                entry_pending = true;
+                string_t entry(ENTRY_FILE);
+                submit(entry); // 入口先于预编译提交
+#if GUI_PREBUILD
+                prebuild();
+#endif
+            }
+            if (entry_pending) {
+                auto pid = compile(ENTRY_FILE, entry_args);
+                if (pid != VM_COMPILE_PENDING) {
+                    entry_pending = false;
+                    if (pid != -1)
+                        running = true;
                 }
             }
         }
@@ -552,170 +634,349 @@ namespace clib {
         memory.free(old_bg);
     }
 
-    void cgui::load_dep(string_t & path, std::unordered_set<string_t> & deps) {
-        auto f = cache_code.find(path);
-        if (f != cache_code.end()) {
-            deps.insert(cache_dep[path].begin(), cache_dep[path].end());
-            return;
-        }
-        auto code = load_file(path);
-        static string_t pat_inc{ "#include[ ]+\"([/A-Za-z0-9_-]+?)\"" };
-        static std::regex re_inc(pat_inc);
-        std::smatch res;
-        auto begin = code.cbegin();
-        auto end = code.cend();
-        std::vector<std::tuple<int, int, string_t>> records;
-        {
-            auto offset = 0;
-            while (std::regex_search(begin, end, res, re_inc)) {
-                if (res[1].str() == path) {
-                    error("cannot include self: " + path);
-                }
-                if (offset + res.position() > 0) {
-                    if (code[offset + res.position() - 1] != '\n') {
-                        error("invalid include: " + res[1].str());
+    static bool is_blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static bool is_ident(char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    // 单遍扫描预处理指令，剥除#include、#pragma once及包含保护，其余原样保留
+    // 被剥除的行保留换行，行号不变；每个文件只展开一次，保护宏无需求值
+    static string_t scan_include(const string_t& code, std::vector<string_t>& includes) {
+        string_t out;
+        out.reserve(code.size());
+        string_t guard; // #ifndef X 之后紧跟 #define X
+        auto guard_state = 0; // 0: 未定 1: 已见#ifndef 2: 保护生效 -1: 无保护
+        auto content = false; // 已有代码或其他指令
+        auto comment = false; // 处于块注释中
+        size_t endif_pos = string_t::npos; // 最后一个#endif在out中的位置
+        auto n = code.length();
+        size_t i = 0;
+        while (i < n) {
+            auto eol = code.find('\n', i);
+            if (eol == string_t::npos)
+                eol = n;
+            auto k = i;
+            while (k < eol && is_blank(code[k]))
+                k++;
+            if (!comment && k < eol && code[k] == '#') {
+                auto p = k + 1;
+                while (p < eol && is_blank(code[p]))
+                    p++;
+                auto w = p;
+                while (p < eol && is_ident(code[p]))
+                    p++;
+                auto word = code.substr(w, p - w);
+                while (p < eol && is_blank(code[p]))
+                    p++;
+                auto q = p;
+                while (q < eol && !is_blank(code[q]))
+                    q++;
+                auto arg = code.substr(p, q - p);
+                auto drop = true;
+                if (word == "include") {
+                    if (arg.length() < 3 || arg.front() != '"' || arg.back() != '"')
+                        throw cexception(ex_gui, "invalid include: " + code.substr(k, eol - k));
+                    auto inc = arg.substr(1, arg.length() - 2);
+                    for (auto& c : inc) {
+                        if (!(is_ident(c) || c == '/' || c == '-'))
+                            throw cexception(ex_gui, "invalid include: " + inc);
                     }
+                    includes.push_back(inc);
                 }
-                records.emplace_back(offset + res.position(),
-                    offset + res.position() + res.length(),
-                    res[1].str());
-                offset += std::distance(begin, res[0].second);
-                begin = res[0].second;
-            }
-        }
-        if (!records.empty()) {
-            // has #include directive
-            std::unordered_set<string_t> _deps;
-            for (auto& r : records) {
-                auto& include_path = std::get<2>(r);
-                load_dep(include_path, _deps);
-                _deps.insert(include_path);
-            }
-            std::stringstream sc;
-            size_t prev = 0;
-            for (auto& r : records) {
-                auto& start = std::get<0>(r);
-                auto& length = std::get<1>(r);
-                if (prev < start - prev) {
-                    auto frag = code.substr((uint)prev, (uint)start - prev);
-                    sc << frag;
+                else if (word == "pragma" && arg == "once") {
                 }
-                prev = length;
-            }
-            if (prev < code.length()) {
-                auto frag = code.substr((uint)prev, code.length() - (uint)prev);
-                sc << frag;
+                else if (word == "ifndef" && guard_state == 0 && !content) {
+                    guard = arg;
+                    guard_state = 1;
+                }
+                else if (word == "define" && guard_state == 1 && arg == guard) {
+                    guard_state = 2;
+                }
+                else if (word == "endif" && guard_state == 2) {
+                    endif_pos = out.length();
+                    drop = false; // 是否为文件末尾的#endif，扫描结束时确定
+                }
+                else {
+                    drop = false;
+                }
+                if (guard_state == 1 && !(word == "ifndef" && arg == guard))
+                    throw cexception(ex_gui, "invalid include guard: " + guard);
+                if (drop) {
+                    if (eol < n)
+                        out += '\n';
+                    i = eol + 1;
+                    continue;
+                }
+                content = content || word != "endif";
             }
-            cache_code.insert(std::make_pair(path, sc.str()));
-            cache_dep.insert(std::make_pair(path, _deps));
-        }
-        else {
-            // no #include directive
-            cache_code.insert(std::make_pair(path, code));
-            cache_dep.insert(std::make_pair(path, std::unordered_set<string_t>()));
-        }
-        load_dep(path, deps);
-    }
-
-    string_t cgui::do_include(string_t & path) { // DAG solution for include
-        std::vector<string_t> v; // VERTEX(Map id to name)
-        std::unordered_map<string_t, int> deps; // VERTEX(Map name to id)
-        {
-            std::unordered_set<string_t> _deps;
-            load_dep(path, _deps);
-            if (_deps.empty())
-                return cache_code[path]; // no include
-            _deps.insert(path);
-            v.resize(_deps.size());
-            std::copy(_deps.begin(), _deps.end(), v.begin());
-            int i = 0;
-            for (auto& d : v) {
-                deps.insert(std::make_pair(d, i++));
-            }
-        }
-        auto n = v.size();
-        std::vector<std::vector<bool>> DAG(n); // DAG(Map id to id)
-        std::unordered_set<size_t> deleted;
-        std::vector<size_t> topo; // 拓扑排序
-        for (size_t i = 0; i < n; ++i) {
-            DAG[i].resize(n);
-            for (size_t j = 0; j < n; ++j) {
-                auto& _d = cache_dep[v[i]];
-                if (_d.find(v[j]) != _d.end())
-                    DAG[i][j] = true;
-            }
-        }
-        // DAG[i][j] == true  =>  i 包含 j
-        for (size_t i = 0; i < n; ++i) { // 每次找出零入度点并删除
-            size_t right = n;
-            for (size_t j = 0; j < n; ++j) { // 找出零入度点
-                if (deleted.find(j) == deleted.end()) {
-                    bool success = true;
-                    for (size_t k = 0; k < n; ++k) {
-                        if (DAG[j][k]) {
-                            success = false;
-                            break;
-                        }
+            // 逐字符跟踪注释与字符串，只为判断下一行是否处于块注释中
+            for (auto j = k; j < eol; ++j) {
+                auto c = code[j];
+                if (comment) {
+                    if (c == '*' && j + 1 < eol && code[j + 1] == '/') {
+                        comment = false;
+                        j++;
                     }
-                    if (success) { // 找到
-                        right = j;
-                        break;
+                }
+                else if (c == '/' && j + 1 < eol && code[j + 1] == '/') {
+                    break;
+                }
+                else if (c == '/' && j + 1 < eol && code[j + 1] == '*') {
+                    comment = true;
+                    j++;
+                }
+                else if (c == '"' || c == '\'') {
+                    for (j++; j < eol && code[j] != c; ++j) {
+                        if (code[j] == '\\')
+                            j++;
                     }
                 }
+                else if (!is_blank(c)) {
+                    content = true;
+                    if (guard_state == 1)
+                        throw cexception(ex_gui, "invalid include guard: " + guard);
+                }
+            }
+            out.append(code, i, eol - i);
+            if (eol < n)
+                out += '\n';
+            i = eol + 1;
+        }
+        if (guard_state == 2) {
+            if (endif_pos == string_t::npos)
+                throw cexception(ex_gui, "unterminated include guard: " + guard);
+            auto e = out.find('\n', endif_pos);
+            auto tail = e == string_t::npos ? out.length() : e;
+            for (auto j = tail; j < out.length(); ++j) {
+                if (!std::isspace((unsigned char)out[j]))
+                    throw cexception(ex_gui, "code after include guard: " + guard);
             }
-            if (right != n) {
-                for (size_t k = 0; k < n; ++k) { // 删除点
-                    DAG[k][right] = false;
+            out.erase(endif_pos, tail - endif_pos);
+        }
+        return out;
+    }
+
+    void cgui::load_dep(string_t & path, std::unordered_set<string_t> & deps) {
+        auto f = cache_code.find(path);
+        if (f != cache_code.end()) {
+            auto& d = cache_dep[path];
+            deps.insert(d.begin(), d.end());
+            return;
+        }
+        auto time = source_time(source_file(path)); // 先取时间，读取期间的修改留待下次检测
+        auto code = load_file(path);
+        std::vector<string_t> includes;
+        auto text = scan_include(code, includes);
+        std::unordered_set<string_t> _deps;
+        including.push_back(path);
+        for (auto& inc : includes) {
+            if (inc[0] != '/')
+                inc = "/bin/" + inc; // 与load_file的命名一致
+            if (inc == path)
+                error("cannot include self: " + path);
+            if (std::find(including.begin(), including.end(), inc) != including.end()) {
+                string_t cycle;
+                for (auto& p : including) {
+                    cycle += p + " -> ";
                 }
-                topo.push_back(right);
-                deleted.insert(right);
+                error("include cycle: " + cycle + inc);
             }
+            load_dep(inc, _deps);
+            _deps.insert(inc);
         }
-        if (topo.size() != n) {
-            error("topo failed: " + path);
+        including.pop_back();
+        cache_time[path] = time;
+        cache_code.insert(std::make_pair(path, text));
+        cache_inc.insert(std::make_pair(path, includes));
+        deps.insert(_deps.begin(), _deps.end());
+        cache_dep.insert(std::make_pair(path, std::move(_deps)));
+    }
+
+    // 按直接包含关系深度优先后序遍历，被包含者在前
+    void cgui::topo_include(const string_t & path, std::unordered_set<string_t> & visited, std::vector<string_t> & units) {
+        if (!visited.insert(path).second)
+            return;
+        for (auto& inc : cache_inc[path]) {
+            topo_include(inc, visited, units);
         }
+        units.push_back(path);
+    }
+
+    string_t cgui::do_include(string_t & path, std::vector<string_t> & units) {
+        units.clear();
+        including.clear();
+        std::unordered_set<string_t> deps;
+        load_dep(path, deps); // 成环时已报错
+        std::unordered_set<string_t> visited;
+        topo_include(path, visited, units);
 #if LOG_DEP
         ATLTRACE("[SYSTEM] DEP  | ---------------\n");
         ATLTRACE("[SYSTEM] DEP  | PATH: %s\n", path.c_str());
-        for (size_t i = 0; i < n; ++i) {
-            ATLTRACE("[SYSTEM] DEP  | [%d] ==> %s\n", i, v[topo[i]].c_str());
+        for (size_t i = 0; i < units.size(); ++i) {
+            ATLTRACE("[SYSTEM] DEP  | [%d] ==> %s\n", i, units[i].c_str());
         }
         ATLTRACE("[SYSTEM] DEP  | ---------------\n");
 #endif
-        std::stringstream ss;
-        for (auto& tp : topo) {
-            ss << cache_code[v[tp]];
+        if (units.size() == 1)
+            return cache_code[path]; // no include
+        string_t code;
+        for (auto& u : units) {
+            code += cache_code[u];
         }
-        return ss.str();
+        return code;
     }
 
+    void cgui::prepare(string_t & path, csource_t & src) {
+        auto start = std::chrono::steady_clock::now();
+        src.code = do_include(path, src.units);
+        src.path = path;
+        for (auto& u : src.units) { // 编译线程不访问虚拟文件系统，源码在此备齐
+            src.unit_code.insert(std::make_pair(u, cache_code[u]));
+            src.unit_dep.insert(std::make_pair(u, cache_dep[u]));
+        }
+        src.include_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool cgui::submit(string_t & path) {
+        std::vector<byte> file;
+        auto fail_errno = -1;
+        if (compiler.query(path, file, fail_errno) != cs_none)
+            return true;
+        try {
+            csource_t src;
+            prepare(path, src);
+            compiler.submit(src);
+            return true;
+        }
+        catch (const cexception & e) {
+            ATLTRACE("[SYSTEM] ERR  | PATH: %s, %s\n", path.c_str(), e.message().c_str());
+            return false;
+        }
+    }
+
+    void cgui::prebuild() {
+        WIN32_FIND_DATAA fd;
+        auto h = FindFirstFileA((string_t(FILE_ROOT) + "/bin/*.cpp").c_str(), &fd);
+        if (h == INVALID_HANDLE_VALUE)
+            return;
+        auto n = 0;
+        do {
+            string_t name(fd.cFileName);
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+            auto path = "/bin/" + name.substr(0, name.length() - 4);
+            if (submit(path))
+                n++;
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+        ATLTRACE("[SYSTEM] COMP | Prebuild: %d files\n", n);
+    }
+
+    void cgui::watch() {
+        if (watch_handle != INVALID_HANDLE_VALUE) {
+            if (WaitForSingleObject(watch_handle, 0) != WAIT_OBJECT_0)
+                return;
+            FindNextChangeNotification(watch_handle);
+        }
+        else if (++watch_ticks < GUI_WATCH_TICKS) {
+            return;
+        }
+        watch_ticks = 0;
+        std::unordered_set<string_t> changed;
+        for (auto& t : cache_time) {
+            if (t.second != 0 && source_time(source_file(t.first)) != t.second)
+                changed.insert(t.first);
+        }
+        if (changed.empty())
+            return;
+        // cache_dep是依赖的传递闭包，包含任一变更文件的路径都要失效
+        auto dirty = changed;
+        for (auto& d : cache_dep) {
+            for (auto& c : changed) {
+                if (d.second.find(c) != d.second.end()) {
+                    dirty.insert(d.first);
+                    break;
+                }
+            }
+        }
+        for (auto& d : dirty) {
+            cache_code.erase(d);
+            cache_dep.erase(d);
+            cache_inc.erase(d);
+            cache_time.erase(d);
+            ATLTRACE("[SYSTEM] COMP | Invalidate: %s\n", d.c_str());
+        }
+        for (auto& p : compiler.invalidate(dirty)) { // 已编译过的程序在后台重新编译
+            submit(p);
+        }
+    }
+
+    string_t cgui::compile_report() {
+        return compiler.report();
+    }
+
+#if GUI_BENCH_COMPILER
+    // 不用缓存，单线程逐个编译全部源码，头文件等无main的单元按失败计
+    void cgui::bench_compiler() {
+        std::vector<string_t> files;
+        bench_files(FILE_ROOT, files);
+        ccompiler bench(1, false);
+        std::vector<string_t> paths;
+        auto root = string_t(FILE_ROOT).length();
+        for (auto& f : files) {
+            if (f.length() <= root + 4 || f.substr(f.length() - 4) != ".cpp")
+                continue;
+            auto path = f.substr(root, f.length() - root - 4);
+            try {
+                csource_t src;
+                prepare(path, src);
+                bench.submit(src);
+                paths.push_back(path);
+            }
+            catch (const cexception & e) {
+                ATLTRACE("[SYSTEM] ERR  | PATH: %s, %s\n", path.c_str(), e.message().c_str());
+            }
+        }
+        std::vector<byte> file;
+        auto fail_errno = 0;
+        for (auto& p : paths) {
+            while (bench.query(p, file, fail_errno) == cs_pending)
+                Sleep(1);
+        }
+        auto s = bench.get_total();
+        ATLTRACE("[SYSTEM] BENCH | Compiler: %d programs, %d units, %.2f ms\n", (int)paths.size(), s.units, s.total + s.include);
+        ATLTRACE("[SYSTEM] BENCH | Include %.2f, Lexer %.2f, Parser %.2f, Gen %.2f, Link %.2f ms\n",
+            s.include, s.lexer, s.parser, s.gen, s.link);
+        ATLTRACE("[SYSTEM] BENCH | %d tokens, %d backtracks, %d AST nodes (%d KB), %d symbols (%d KB), %d instructions\n",
+            s.tokens, s.backtracks, s.ast_nodes, (int)(s.ast_bytes / 1024),
+            s.symbols, (int)(s.symbol_bytes / 1024), s.instructions);
+    }
+#endif
+
     int cgui::compile(const string_t & path, const std::vector<string_t> & args) {
         if (path.empty())
             return -1;
-        auto fail_errno = -1;
-        auto new_path = path;
+        auto new_path = path[0] == '/' ? path : "/bin/" + path; // 与load_file的命名一致
         try {
-            auto c = cache.find(new_path);
-            if (c != cache.end()) {
-                return vm->load(new_path, c->second, args);
-            }
-            auto code = do_include(new_path);
-            fail_errno = -2;
-            gen.reset();
-            auto root = p.parse(code, &gen);
-#if LOG_AST
-            cast::print(root, 0, std::cout);
-#endif
-            gen.gen(root);
-            auto file = gen.file();
-            p.clear_ast();
-            cache.insert(std::make_pair(new_path, file));
-            return vm->load(new_path, file, args);
+            std::vector<byte> file;
+            auto fail_errno = -1;
+            switch (compiler.query(new_path, file, fail_errno)) {
+            case cs_done:
+                return vm->load(new_path, file, args);
+            case cs_failed:
+                return fail_errno;
+            case cs_pending:
+                return VM_COMPILE_PENDING;
+            default:
+                return submit(new_path) ? VM_COMPILE_PENDING : -1;
+            }
         }
         catch (const cexception & e) {
-            gen.reset();
             ATLTRACE("[SYSTEM] ERR  | PATH: %s, %s\n", new_path.c_str(), e.message().c_str());
-            return fail_errno;
+            return -1;
         }
     }
 
@@ -740,19 +1001,21 @@ namespace clib {
 
     void cgui::input(int c) {
         if (c == 3) {
-            cvm::global_state.interrupt = true;
+            if (!vm)
+                return;
+            vm->global_state.interrupt = true;
             if (input_state) {
                 ptr_x = ptr_rx;
                 ptr_y = ptr_ry;
                 put_char('\n');
-                cvm::global_state.input_content.clear();
-                cvm::global_state.input_read_ptr = 0;
-                cvm::global_state.input_success = true;
+                vm->global_state.input_content.clear();
+                vm->global_state.input_read_ptr = 0;
+                vm->global_state.input_success = true;
                 input_state = false;
             }
             return;
         }
-        if (!input_state)
+        if (!input_state || !vm)
             return;
         if (!((c & GUI_SPECIAL_MASK) || std::isprint(c) || c == '\b' || c == '\n' || c == '\r' || c == 4 || c == 7 || c == 26)) {
             ATLTRACE("[SYSTEM] GUI  | Input: %d\n", (int)c);
@@ -766,9 +1029,9 @@ namespace clib {
             ptr_x = ptr_rx;
             ptr_y = ptr_ry;
             put_char('\n');
-            cvm::global_state.input_content = input_buffer();
-            cvm::global_state.input_read_ptr = 0;
-            cvm::global_state.input_success = true;
+            vm->global_state.input_content = input_buffer();
+            vm->global_state.input_read_ptr = 0;
+            vm->global_state.input_success = true;
             input_state = false;
             return;
         }
@@ -809,10 +1072,10 @@ namespace clib {
                 printf("invalid special key: %d\n", c & 0xff);
                 return;
             }
-            cvm::global_state.input_content = input_buffer();
-            cvm::global_state.input_content.push_back(C);
-            cvm::global_state.input_read_ptr = 0;
-            cvm::global_state.input_success = true;
+            vm->global_state.input_content = input_buffer();
+            vm->global_state.input_content.push_back(C);
+            vm->global_state.input_read_ptr = 0;
+            vm->global_state.input_success = true;
             input_state = false;
             auto begin = ptr_mx + ptr_my * cols;
             auto end = ptr_x + ptr_y * cols;
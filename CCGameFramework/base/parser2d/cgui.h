@@ -10,8 +10,8 @@
 #include <array>
 #include <deque>
 #include "types.h"
-#include "cparser.h"
-#include "cgen.h"
+#include "ccompiler.h"
+#include "cvm.h"
 #include "parser2d.h"
 
 #define GUI_FONT GLUT_BITMAP_9_BY_15
@@ -33,31 +33,36 @@
 #define GUI_INPUT_CARET 15
 #define GUI_MEMORY (256 * 1024)
 #define GUI_SPECIAL_MASK 0x2000
+#define GUI_SMP_WORKERS 0 // 大于1时启用多核执行
+#define GUI_PREBUILD 1 // 启动时在后台预编译/bin下的程序
+#define GUI_WATCH_TICKS 60 // 无法监听目录时，每隔若干帧轮询源文件
+#define GUI_BENCH_COMPILER 0 // 启动时单线程编译script/code下全部源码，输出各阶段耗时
 
 namespace clib {
 
-    class cgui {
+    class cgui : public vm_host_t {
     public:
         cgui();
-        ~cgui() = default;
+        ~cgui();
 
         cgui(const cgui&) = delete;
         cgui& operator=(const cgui&) = delete;
 
         void draw(CComPtr<ID2D1RenderTarget>& rt, const CRect& bounds, const Parser2DEngine::BrushBag& brushes, bool paused, decimal fps);
-        int compile(const string_t& path, const std::vector<string_t>& args);
+        int compile(const string_t& path, const std::vector<string_t>& args) override;
+        string_t compile_report() override;
 
         void put_string(const string_t& str);
-        void put_char(char c);
-        void input_char(char c);
+        void put_char(char c) override;
+        void input_char(char c) override;
 
-        void set_cycle(int cycle);
+        void set_cycle(int cycle) override;
         void set_ticks(int ticks);
-        void resize(int rows, int cols);
+        void resize(int rows, int cols) override;
 
-        void input_set(bool valid);
+        void input_set(bool valid) override;
         void input(int c);
-        void reset_cmd();
+        void reset_cmd() override;
         int reset_cycles();
 
     private:
@@ -68,7 +73,15 @@ namespace clib {
         inline void draw_char(const char& c);
 
         void load_dep(string_t& path, std::unordered_set<string_t>& deps);
-        string_t do_include(string_t& path);
+        void topo_include(const string_t& path, std::unordered_set<string_t>& visited, std::vector<string_t>& units);
+        string_t do_include(string_t& path, std::vector<string_t>& units);
+        void prepare(string_t& path, csource_t& src);
+        bool submit(string_t& path);
+        void prebuild();
+#if GUI_BENCH_COMPILER
+        void bench_compiler();
+#endif
+        void watch();
 
         void exec_cmd(const string_t& s);
 
@@ -84,16 +97,21 @@ namespace clib {
         void reset();
 
     private:
-        cgen gen;
-        cparser p;
+        ccompiler compiler;
         std::unique_ptr<cvm> vm;
         memory_pool<GUI_MEMORY> memory;
         char* buffer{ nullptr };
         uint32_t* colors_bg{ nullptr };
         uint32_t* colors_fg{ nullptr };
-        std::unordered_map<string_t, std::vector<byte>> cache;
         std::unordered_map<string_t, string_t> cache_code;
-        std::unordered_map<string_t, std::unordered_set<string_t>> cache_dep;
+        std::unordered_map<string_t, std::unordered_set<string_t>> cache_dep; // 包含关系的传递闭包
+        std::unordered_map<string_t, std::vector<string_t>> cache_inc; // 直接包含的文件
+        std::vector<string_t> including; // 正在展开的包含链，用于检测成环
+        std::unordered_map<string_t, uint64_t> cache_time; // 宿主源文件修改时间，0为不监视
+        HANDLE watch_handle{ INVALID_HANDLE_VALUE };
+        int watch_ticks{ 0 };
+        std::vector<string_t> entry_args;
+        bool entry_pending{ false };
         std::vector<uint32_t> color_bg_stack;
         std::vector<uint32_t> color_fg_stack;
         bool running{ false };
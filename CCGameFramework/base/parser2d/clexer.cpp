@@ -7,10 +7,65 @@
 #include <cassert>
 #include <climits>
 #include <sstream>
+#include <cstring>
 #include "clexer.h"
+#include "cexception.h"
+
+#define KEYWORD_HASH_SIZE 128
+#define IDENT_SLOTS_INIT 256
 
 namespace clib {
 
+    // 关键字完美哈希：用首尾字符与长度散列，构造时搜索无冲突的系数
+    class keyword_hash {
+    public:
+        keyword_hash() {
+            for (a = 1; a < KEYWORD_HASH_SIZE; a++) {
+                for (b = 1; b < KEYWORD_HASH_SIZE; b++) {
+                    if (build())
+                        return;
+                }
+            }
+            // 关键字表变动后可能找不到系数，Release下也必须报错
+            throw cexception(ex_parser, "keyword perfect hash not found, enlarge KEYWORD_HASH_SIZE");
+        }
+
+        keyword_t find(const char* s, uint len) const {
+            auto k = table[hash(s, len)];
+            if (k == k__start)
+                return k__start;
+            const auto& kw = KEYWORD_STRING(k);
+            if (kw.length() != len || std::memcmp(kw.c_str(), s, len) != 0)
+                return k__start;
+            return k;
+        }
+
+        static const keyword_hash& singleton() {
+            static keyword_hash hash;
+            return hash;
+        }
+
+    private:
+        uint hash(const char* s, uint len) const {
+            return ((byte)s[0] + (byte)s[len - 1] * a + len * b) & (KEYWORD_HASH_SIZE - 1);
+        }
+
+        bool build() {
+            table.fill(k__start);
+            for (auto i = k__start + 1; i < k__end; i++) {
+                const auto& kw = KEYWORD_STRING((keyword_t)i);
+                auto& k = table[hash(kw.c_str(), kw.length())];
+                if (k != k__start)
+                    return false;
+                k = (keyword_t)i;
+            }
+            return true;
+        }
+
+        uint a{ 0 }, b{ 0 };
+        std::array<keyword_t, KEYWORD_HASH_SIZE> table;
+    };
+
     clexer::clexer(string_t str) : str(str) {
         length = (uint)str.length();
         assert(length > 0);
@@ -37,14 +92,43 @@ LEX_T(t) clexer::get_##t() const \
         DEFINE_LEXER_GETTER(double)
         DEFINE_LEXER_GETTER(operator)
         DEFINE_LEXER_GETTER(keyword)
-        DEFINE_LEXER_GETTER(identifier)
-        DEFINE_LEXER_GETTER(string)
-        DEFINE_LEXER_GETTER(comment)
         DEFINE_LEXER_GETTER(space)
         DEFINE_LEXER_GETTER(newline)
         DEFINE_LEXER_GETTER(error)
 #undef DEFINE_LEXER_GETTER
 
+    const string_t& clexer::get_identifier() const {
+        assert(bags._identifier >= 0 && bags._identifier < (int)ident_strs.size());
+        return get_identifier(bags._identifier);
+    }
+
+    const string_t& clexer::get_string() const {
+        return bags._string;
+    }
+
+    string_t clexer::get_comment() const {
+        return str.substr(bags._comment_offset, bags._comment_length);
+    }
+
+    int clexer::get_identifier_id() const {
+        return bags._identifier;
+    }
+
+    const string_t& clexer::get_identifier(int id) const {
+        static const string_t empty;
+        if (id < 0 || id >= (int)ident_strs.size()) // 尚未读到标识符
+            return empty;
+        return ident_strs[id];
+    }
+
+    uint clexer::get_offset() const {
+        return last_index;
+    }
+
+    uint clexer::get_length() const {
+        return index - last_index;
+    }
+
 #define DEFINE_LEXER_GETTER(t) \
 LEX_T(t) clexer::get_store_##t(int index) const \
 { \
@@ -73,7 +157,6 @@ LEX_T(t) clexer::get_store_##t(int index) const \
         err.start_idx = index; // 文本起始位置
         err.end_idx = index + skip; // 文本结束位置
         err.err = error; // 错误类型
-        err.str = str.substr(err.start_idx, err.end_idx - err.start_idx); // 错误字符
         records.push_back(err);
         bags._error = error;
         move(skip); // 略过错误文本
@@ -84,6 +167,12 @@ LEX_T(t) clexer::get_store_##t(int index) const \
         return records.back();
     }
 
+    string_t clexer::error_str(const err_record_t & err) const {
+        if (err.start_idx >= length)
+            return "";
+        return str.substr(err.start_idx, err.end_idx - err.start_idx); // 错误字符
+    }
+
     lexer_t clexer::next() {
         auto c = local();
         if (c == -1) {
@@ -564,19 +653,50 @@ LEX_T(t) clexer::get_store_##t(int index) const \
     lexer_t clexer::next_alpha() {
         uint i;
         for (i = index + 1; i < length && (isalnum(str[i]) || str[i] == '_'); i++);
-        auto s = str.substr(index, i - index);
-        auto kw = mapKeyword.find(s);
-        if (kw != mapKeyword.end()) { // 哈希查找关键字
-            bags._keyword = kw->second;
-            move(s.length());
+        auto len = i - index;
+        auto kw = keyword_hash::singleton().find(str.c_str() + index, len);
+        if (kw != k__start) { // 哈希查找关键字
+            bags._keyword = kw;
+            move(len);
             return l_keyword;
         }
         // 普通变量名
-        bags._identifier = s;
-        move(s.length());
+        bags._identifier = intern(index, len);
+        move(len);
         return l_identifier;
     }
 
+    int clexer::intern(uint offset, uint len) {
+        auto s = str.c_str() + offset;
+        auto h = 2166136261U;
+        for (uint i = 0; i < len; i++) {
+            h ^= (byte)s[i];
+            h *= 16777619U;
+        }
+        if (idents.size() * 2 >= ident_slots.size()) { // 扩容并重新散列
+            ident_slots.assign(ident_slots.empty() ? IDENT_SLOTS_INIT : ident_slots.size() * 2, -1);
+            auto mask = (uint)ident_slots.size() - 1;
+            for (size_t i = 0; i < idents.size(); i++) {
+                auto j = idents[i].hash & mask;
+                while (ident_slots[j] != -1)
+                    j = (j + 1) & mask;
+                ident_slots[j] = (int)i;
+            }
+        }
+        auto mask = (uint)ident_slots.size() - 1;
+        auto j = h & mask;
+        for (; ident_slots[j] != -1; j = (j + 1) & mask) {
+            auto& id = idents[ident_slots[j]];
+            if (id.hash == h && id.length == len && std::memcmp(str.c_str() + id.offset, s, len) == 0)
+                return ident_slots[j];
+        }
+        auto id = (int)idents.size();
+        idents.push_back({ offset, len, h });
+        ident_strs.emplace_back(s, len);
+        ident_slots[j] = id;
+        return id;
+    }
+
     lexer_t clexer::next_space() {
         uint i, j;
         switch (str[index]) {
@@ -737,7 +857,8 @@ LEX_T(t) clexer::get_store_##t(int index) const \
         if (j == length) { // " EOF
             return record_error(e_invalid_string, i - index);
         }
-        std::stringstream ss;
+        auto& ss = bags._string; // 复用缓冲区
+        ss.clear();
         auto status = 1; // 状态机
         char c = 0;
         for (i = index + 1; i < j;) {
@@ -747,7 +868,7 @@ LEX_T(t) clexer::get_store_##t(int index) const \
                     status = 2;
                 }
                 else { // '?'
-                    ss << str[i];
+                    ss.push_back(str[i]);
                 }
                 i++;
             }
@@ -760,7 +881,7 @@ LEX_T(t) clexer::get_store_##t(int index) const \
                 else {
                     auto esc = escape(str[i]);
                     if (esc != -1) {
-                        ss << (char)esc;
+                        ss.push_back((char)esc);
                         i++;
                         status = 1;
                     }
@@ -787,28 +908,27 @@ LEX_T(t) clexer::get_store_##t(int index) const \
                 if (esc != -1) {
                     c *= 10;
                     c += (char)esc;
-                    ss << c;
+                    ss.push_back(c);
                     status = 1;
                     i++;
                 }
                 else {
-                    ss << c;
+                    ss.push_back(c);
                     status = 1;
                 }
             }
                     break;
             default: // 失败
-                bags._string = str.substr(index + 1, j - index - 1);
+                bags._string.assign(str, index + 1, j - index - 1);
                 move(j - index + 1);
                 return l_string;
             }
         }
         if (status == 1) { // 为初态/终态
-            bags._string = ss.str();
             move(j - index + 1);
             return l_string;
         }
-        bags._string = str.substr(index + 1, j - index - 1);
+        bags._string.assign(str, index + 1, j - index - 1);
         move(j - index + 1);
         return l_string;
     }
@@ -818,7 +938,8 @@ LEX_T(t) clexer::get_store_##t(int index) const \
         if (str[++i] == '/') { // '//'
             // 寻找第一个换行符
             for (++i; i < length && (str[i] != '\n' && str[i] != '\r'); i++);
-            bags._comment = str.substr(index + 2, i - index - 2);
+            bags._comment_offset = index + 2;
+            bags._comment_length = i - index - 2;
             move(i - index);
             return l_comment;
         }
@@ -829,7 +950,8 @@ LEX_T(t) clexer::get_store_##t(int index) const \
             for (++i; i < length && (prev != '*' || (str[i]) != '/');
                 prev = str[i++], prev == '\n' ? ++newline : 0);
             i++;
-            bags._comment = str.substr(index + 2, i - index - 1);
+            bags._comment_offset = index + 2;
+            bags._comment_length = min(i - index - 1, length - index - 2);
             move(i - index, newline); // 检查换行
             return l_comment;
         }
@@ -956,10 +1078,6 @@ LEX_T(t) clexer::get_store_##t(int index) const \
     }
 
     void clexer::initMap() {
-        // Keyword
-        for (auto i = k__start + 1; i < k__end; i++) {
-            mapKeyword[KEYWORD_STRING((keyword_t)i)] = (keyword_t)i;
-        }
         auto len = 0;
         for (auto i = op__start + 1; i < op__end; i++) {
             const auto& op = OP_STRING((operator_t)i);
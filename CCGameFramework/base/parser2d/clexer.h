@@ -36,13 +36,18 @@ namespace clib {
             DEFINE_LEXER_GETTER(double)
             DEFINE_LEXER_GETTER(operator)
             DEFINE_LEXER_GETTER(keyword)
-            DEFINE_LEXER_GETTER(identifier)
-            DEFINE_LEXER_GETTER(string)
-            DEFINE_LEXER_GETTER(comment)
             DEFINE_LEXER_GETTER(space)
             DEFINE_LEXER_GETTER(newline)
             DEFINE_LEXER_GETTER(error)
 #undef DEFINE_LEXER_GETTER
+        const string_t& get_identifier() const;
+        const string_t& get_string() const;
+        string_t get_comment() const;
+        int get_identifier_id() const; // 同一标识符编号相同
+        const string_t& get_identifier(int id) const;
+        // 当前记号在源码中的位置
+        uint get_offset() const;
+        uint get_length() const;
 #define DEFINE_LEXER_GETTER(t) LEX_T(t) get_store_##t(int) const;
             DEFINE_LEXER_GETTER(char)
             DEFINE_LEXER_GETTER(uchar)
@@ -63,9 +68,10 @@ namespace clib {
             int line, column;
             uint start_idx, end_idx;
             error_t err;
-            string_t str;
         };
 
+        string_t error_str(const err_record_t& err) const;
+
     private:
         std::vector<err_record_t> records;
 
@@ -90,6 +96,7 @@ namespace clib {
 
     private:
         void move(uint idx, int inc = -1);
+        int intern(uint offset, uint len);
 
         // 内部解析
         lexer_t next_digit();
@@ -141,13 +148,14 @@ namespace clib {
                 DEFINE_LEXER_GETTER(double, 0)
                 DEFINE_LEXER_GETTER(operator, op__start)
                 DEFINE_LEXER_GETTER(keyword, k__start)
-                DEFINE_LEXER_GETTER(identifier, "")
                 DEFINE_LEXER_GETTER(string, "")
-                DEFINE_LEXER_GETTER(comment, "")
                 DEFINE_LEXER_GETTER(space, 0)
                 DEFINE_LEXER_GETTER(newline, 0)
                 DEFINE_LEXER_GETTER(error, e__start)
 #undef DEFINE_LEXER_GETTER
+            int _identifier{ -1 };
+            uint _comment_offset{ 0 };
+            uint _comment_length{ 0 };
         } bags;
 
         struct {
@@ -173,8 +181,17 @@ namespace clib {
 #undef DEFINE_LEXER_STORAGE
         } storage;
 
+        // 标识符表，开放定址，按源码位置比较，不复制文本
+        struct ident_t {
+            uint offset;
+            uint length;
+            uint hash;
+        };
+        std::vector<ident_t> idents;
+        std::vector<string_t> ident_strs;
+        std::vector<int> ident_slots;
+
         // 字典
-        map_t<string_t, keyword_t> mapKeyword;
         std::bitset<128> bitOp[2];
         std::array<operator_t, 0x100> sinOp;
 
@@ -6,6 +6,7 @@
 #ifndef CLIBPARSER_CNET_H
 #define CLIBPARSER_CNET_H
 
+#include <atomic>
 #include "types.h"
 #include "cvfs.h"
 
@@ -23,10 +24,10 @@ namespace clib {
         static CString Utf8ToStringT(LPCSTR str);
         static CStringA StringTToUtf8(CString str);
 
-        static int get_id();
+        int get_id();
 
     private:
-        static int req_id;
+        int req_id{ 0 };
     };
 
     class vfs_node_stream_net : public vfs_node_dec {
@@ -41,8 +42,11 @@ namespace clib {
         ~vfs_node_stream_net();
 
     public:
+        // 0=等待响应 1=句柄已关闭 2=已收到
+        using state_t = std::shared_ptr<std::atomic<int>>;
+
         string_t get_url() const;
-        int* get_received() const;
+        state_t get_received() const;
         void set_response(const string_t& resp);
 
     private:
@@ -50,31 +54,9 @@ namespace clib {
         vfs_stream_call* call{ nullptr };
         string_t url;
         string_t content;
-        int* received{ nullptr };
+        state_t received;
         int id{ -1 };
     };
-
-    struct net_http_request
-    {
-        cint id;
-        string_t url;
-        bool b64;
-        bool post;
-        string_t postfield;
-        vfs_node_stream_net* net;
-        int* received;
-    };
-
-    struct net_http_response
-    {
-        cint id;
-        UINT code;
-        string_t text;
-        bool b64;
-        bool post;
-        vfs_node_stream_net* net;
-        int* received;
-    };
 }
 
 #endif //CLIBPARSER_CNET_H
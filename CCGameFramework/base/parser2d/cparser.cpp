@@ -6,7 +6,9 @@
 #include "stdafx.h"
 #include <iomanip>
 #include <iostream>
+#include <fstream>
 #include <algorithm>
+#include <chrono>
 #include "cexception.h"
 #include "cparser.h"
 #include "clexer.h"
@@ -16,24 +18,51 @@
 #define TRACE_PARSING 0
 #define DUMP_PDA 0
 #define DUMP_PDA_FILE "PDA.txt"
+#define PDA_TABLE 1 // 缓存生成的PDA表，文法签名不变时跳过表的生成
+#define PDA_TABLE_FILE "./script/pda.bin"
+#define LR_PARSE 1 // 优先使用LALR(1)分析表，失败时回退到回溯分析
 #define DEBUG_AST 0
 #define CHECK_AST 0
+#define LEXER_TIME 0 // 逐个记号统计词法分析耗时，关闭时计入语法分析
 
 namespace clib {
 
+    cparser::cparser()
+        : unit(cgrammar::singleton().get_unit()),
+          lr_terminals(cgrammar::singleton().get_lr_terminals()) {}
+
     ast_node* cparser::parse(const string_t& str, csemantic* s) {
         semantic = s;
+        stat = cparser_stat_t();
         lexer = std::make_unique<clexer>(str);
         ast = std::make_unique<cast>();
         // 清空词法分析结果
         lexer->reset();
         // 清空AST
         ast->reset();
-        // 产生式
-        if (unit.get_pda().empty())
-            gen();
+#if LR_PARSE
+        if (unit.get_lr().states > 0 && unit.get_lr().conflicts == 0) {
+            if (semantic)
+                semantic->snapshot();
+            if (program_lr()) {
+                stat.lr = true;
+                stat.ast_nodes = ast->node_count();
+                stat.ast_bytes = ast->used();
+                return ast->get_root();
+            }
+            // 重新开始，使用回溯分析
+            if (semantic)
+                semantic->restore();
+            lexer = std::make_unique<clexer>(str);
+            ast = std::make_unique<cast>();
+            lexer->reset();
+            ast->reset();
+        }
+#endif
         // 语法分析（递归下降）
         program();
+        stat.ast_nodes = ast->node_count();
+        stat.ast_bytes = ast->used();
         return ast->get_root();
     }
 
@@ -41,11 +70,18 @@ namespace clib {
         return ast->get_root();
     }
 
+    const cparser_stat_t& cparser::get_stat() const {
+        return stat;
+    }
+
     void cparser::clear_ast() {
         ast.reset();
     }
 
     void cparser::next() {
+#if LEXER_TIME
+        auto start = std::chrono::steady_clock::now();
+#endif
         lexer_t token;
         do {
             token = lexer->next();
@@ -55,9 +91,13 @@ namespace clib {
                     err.line,
                     err.column,
                     ERROR_STRING(err.err).c_str(),
-                    err.str.c_str());
+                    lexer->error_str(err).c_str());
             }
         } while (token == l_newline || token == l_space || token == l_error || token == l_comment);
+        stat.tokens++;
+#if LEXER_TIME
+        stat.lexer_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#endif
 #if 0
         if (token != l_end) {
             ATLTRACE("[%04d:%03d] %-12s - %s\n",
@@ -69,7 +109,32 @@ namespace clib {
 #endif
     }
 
-    void cparser::gen() {
+    const cgrammar& cgrammar::singleton() {
+        // 局部静态变量的初始化是线程安全的
+        static cgrammar grammar;
+        return grammar;
+    }
+
+    cgrammar::cgrammar() {
+        // 产生式
+        gen();
+        const auto& lr = unit.get_lr();
+        for (size_t i = 0; i < lr.symbols.size(); ++i) {
+            auto& s = lr.symbols[i];
+            if (!s.type_name)
+                lr_terminals.insert(std::make_pair((int)s.type << 16 | s.value, (int)i));
+        }
+    }
+
+    const cunit& cgrammar::get_unit() const {
+        return unit;
+    }
+
+    const std::unordered_map<int, int>& cgrammar::get_lr_terminals() const {
+        return lr_terminals;
+    }
+
+    void cgrammar::gen() {
         // REFER: antlr/grammars-v4
         // URL: https://github.com/antlr/grammars-v4/blob/master/c/C.g4
 #define DEF_KEYWORD(name) auto &_##name##_ = unit.token(k_##name)
@@ -211,7 +276,7 @@ namespace clib {
         DEF_RULE(initDeclarator);
         DEF_RULE(storageClassSpecifier);
         DEF_RULE_NOT_GREED(typeSpecifier);
-        DEF_RULE(structOrUnionSpecifier);
+        DEF_RULE_ATTR(structOrUnionSpecifier, r_semantic);
         DEF_RULE(structOrUnion);
         DEF_RULE(structDeclarationList);
         DEF_RULE(structDeclaration);
@@ -234,7 +299,7 @@ namespace clib {
         DEF_RULE(typeName);
         DEF_RULE(abstractDeclarator);
         DEF_RULE(directAbstractDeclarator);
-        DEF_RULE(typedefName);
+        DEF_RULE_ATTR(typedefName, r_type_name);
         DEF_RULE(initializer);
         DEF_RULE(initializerList);
         DEF_RULE(designation);
@@ -385,10 +450,43 @@ namespace clib {
         externalDeclaration = functionDefinition | declaration | ~_semi_;
         functionDefinition = *declarationSpecifiers + declarator + *declarationList + compoundStatement;
         declarationList = *declarationList + declaration;
+        // LR冲突裁决，与回溯分析的选择保持一致
+        unit.precedence(selectionStatement, _else_, false);
+        unit.precedence(typeSpecifier, false);
+        unit.precedence(declarationSpecifier, true);
+        unit.precedence(declarationSpecifiers, true);
+        unit.precedence(specifierQualifierList, true);
+#if PDA_TABLE
+        auto stamp = unit.signature();
+        {
+            std::ifstream ifs(PDA_TABLE_FILE, std::ios::binary);
+            if (ifs && unit.load(ifs, stamp))
+                return;
+        }
+#endif
         unit.gen(&compilationUnit);
 #if DUMP_PDA
         std::ofstream of(DUMP_PDA_FILE);
         unit.dump(of);
+#endif
+#if PDA_TABLE
+        {
+            // 先写临时文件再替换，其他实例同时启动时不会读到半个表
+            char tid[32];
+            snprintf(tid, sizeof(tid), ".%lu.tmp", (unsigned long)GetCurrentThreadId());
+            auto tmp = string_t(PDA_TABLE_FILE) + tid;
+            auto ok = false;
+            {
+                std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+                if (ofs)
+                    unit.save(ofs, stamp);
+                ok = !ofs.fail();
+            }
+            if (!ok || !MoveFileExA(tmp.c_str(), PDA_TABLE_FILE, MOVEFILE_REPLACE_EXISTING)) {
+                DeleteFileA(tmp.c_str());
+                ATLTRACE("[SYSTEM] ERR  | PDA: save failed %s\n", PDA_TABLE_FILE);
+            }
+        }
 #endif
     }
 
@@ -425,7 +523,6 @@ namespace clib {
         ast_stack.clear();
         ast_cache.clear();
         ast_cache_index = 0;
-        ast_coll_cache.clear();
         ast_reduce_cache.clear();
         state_stack.push_back(0);
         const auto& pdas = unit.get_pda();
@@ -441,11 +538,12 @@ namespace clib {
         bk_tmp.state_stack = state_stack;
         bk_tmp.ast_stack = ast_stack;
         bk_tmp.current_state = 0;
-        bk_tmp.coll_index = 0;
+        bk_tmp.coll_mark = ast->mark();
         bk_tmp.reduce_index = 0;
         bk_tmp.direction = b_next;
         std::vector<backtrace_t> bks;
         bks.push_back(bk_tmp);
+        stat.backtracks++;
         auto trans_id = -1;
         while (!bks.empty()) {
             auto bk = &bks.back();
@@ -488,6 +586,7 @@ namespace clib {
                     }
                     else {
                         trans_ids.clear();
+                        la_current = la_token(); // 一次算出当前记号，逐个转移只需测试一位
                         if (is_end) {
                             for (size_t i = 0; i < trans.size(); ++i) {
                                 auto& cs = trans[i];
@@ -512,25 +611,26 @@ namespace clib {
                                 bk_tmp.ast_stack = ast_stack;
                                 bk_tmp.current_state = state;
                                 bk_tmp.trans_ids = trans_ids;
-                                bk_tmp.coll_index = ast_coll_cache.size();
+                                bk_tmp.coll_mark = ast->mark();
                                 bk_tmp.reduce_index = ast_reduce_cache.size();
                                 bk_tmp.direction = b_next;
 #if DEBUG_AST
                                 for (auto i = 0; i < bks.size(); ++i) {
                                     auto& _bk = bks[i];
-                                    ATLTRACE("[DEBUG] Branch old: i=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CI=%d, RI=%d, TK=%d\n",
+                                    ATLTRACE("[DEBUG] Branch old: i=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CM=%d:%d, RI=%d, TK=%d\n",
                                         i, _bk.lexer_index, _bk.state_stack.size(),
                                         _bk.ast_stack.size(), _bk.current_state, _bk.trans_ids.size(),
-                                        _bk.coll_index, _bk.reduce_index, _bk.ast_ids.size());
+                                        (int)_bk.coll_mark.chunk, (int)_bk.coll_mark.offset, _bk.reduce_index, _bk.ast_ids.size());
                                 }
 #endif
                                 bks.push_back(bk_tmp);
+                                stat.backtracks++;
                                 bk = &bks.back();
 #if DEBUG_AST
-                                ATLTRACE("[DEBUG] Branch new: BS=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CI=%d, RI=%d, TK=%d\n",
+                                ATLTRACE("[DEBUG] Branch new: BS=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CM=%d:%d, RI=%d, TK=%d\n",
                                     bks.size(), bk_tmp.lexer_index, bk_tmp.state_stack.size(),
                                     bk_tmp.ast_stack.size(), bk_tmp.current_state, bk_tmp.trans_ids.size(),
-                                    bk_tmp.coll_index, bk_tmp.reduce_index, bk_tmp.ast_ids.size());
+                                    (int)bk_tmp.coll_mark.chunk, (int)bk_tmp.coll_mark.offset, bk_tmp.reduce_index, bk_tmp.ast_ids.size());
 #endif
                                 bk->direction = b_next;
                                 break;
@@ -581,10 +681,10 @@ namespace clib {
 #if DEBUG_AST
                 for (auto i = 0; i < bks.size(); ++i) {
                     auto& _bk = bks[i];
-                    ATLTRACE("[DEBUG] Backtrace failed: i=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CI=%d, RI=%d, TK=%d\n",
+                    ATLTRACE("[DEBUG] Backtrace failed: i=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CM=%d:%d, RI=%d, TK=%d\n",
                         i, _bk.lexer_index, _bk.state_stack.size(),
                         _bk.ast_stack.size(), _bk.current_state, _bk.trans_ids.size(),
-                        _bk.coll_index, _bk.reduce_index, _bk.ast_ids.size());
+                        (int)_bk.coll_mark.chunk, (int)_bk.coll_mark.offset, _bk.reduce_index, _bk.ast_ids.size());
                 }
 #endif
                 for (auto& i : bk->ast_ids) {
@@ -608,27 +708,143 @@ namespace clib {
                     check_ast(coll);
                 }
                 ast_reduce_cache.erase(ast_reduce_cache.begin() + bk->reduce_index, ast_reduce_cache.end());
-                size = ast_coll_cache.size();
-                for (auto i = size; i > bk->coll_index; --i) {
-                    auto& coll = ast_coll_cache[i - 1];
-                    assert(coll->flag == ast_collection);
-                    check_ast(coll);
-#if DEBUG_AST
-                    ATLTRACE("[DEBUG] Backtrace failed, delete coll: %p, PB=%p, CB=%p, NE=%d, CS=%d\n",
-                        coll, coll->parent, coll->child,
-                        cast::children_size(coll->parent), cast::children_size(coll));
-#endif
-                    cast::unlink(coll);
-                    check_ast(coll);
-                    ast->remove(coll);
-                }
-                ast_coll_cache.erase(ast_coll_cache.begin() + bk->coll_index, ast_coll_cache.end());
+                // 分支之后新建的非终结符结点已全部断开，整体回退
+                ast->rewind(bk->coll_mark);
                 bk->direction = b_fallback;
             }
             trans_id = -1;
         }
     }
 
+    bool cparser::program_lr() {
+        const auto& lr = unit.get_lr();
+        base_type = l_none;
+        next();
+        ast_cache.clear();
+        ast_cache_index = 0;
+        std::vector<int> states{ 0 };
+        std::vector<ast_node*> values{ nullptr };
+        ast_node* token = nullptr;
+        auto a = 0;
+        auto read = [&]() {
+            if (lexer->is_type(l_end)) {
+                token = nullptr;
+                a = 0;
+            }
+            else {
+                token = terminal();
+                a = lr_terminal(token);
+            }
+        };
+        // 产生式中途的语义检查，用临时结点拼出当前已识别的部分
+        auto check = [&]() {
+            auto item = lr.semantic[states.back()];
+            if (!semantic || item == -1)
+                return true;
+            auto& p = lr.productions[item >> 8];
+            auto begin = values.size() - (item & 0xff);
+            auto i = begin;
+            ast_node* node;
+            if (p.recursive) {
+                node = values[i++];
+            }
+            else {
+                node = ast->new_node(ast_collection);
+                node->line = node->column = 0;
+                node->data._coll = p.coll;
+            }
+            std::vector<ast_node*> children;
+            for (; i < values.size(); ++i) {
+                if (p.rhs[i - begin] < lr.terminals && p.skip[i - begin])
+                    continue;
+                cast::set_child(node, values[i]);
+                children.push_back(values[i]);
+            }
+            auto direction = semantic->check(e_move, node);
+            for (auto& c : children)
+                cast::unlink(c);
+            if (!p.recursive)
+                ast->remove(node);
+            return direction != b_error;
+        };
+        read();
+        for (;;) {
+            if (a == -1)
+                return false;
+            auto state = states.back();
+            auto act = lr.action[state * lr.terminals + a];
+            if (a == lr.identifier && lr.type_name != -1 && semantic && semantic->is_type(token->data._string)) {
+                auto type_act = lr.action[state * lr.terminals + lr.type_name];
+                if (LR_ACTION_TYPE(type_act) != lr_error)
+                    act = type_act;
+            }
+            switch (LR_ACTION_TYPE(act)) {
+            case lr_shift:
+                states.push_back(LR_ACTION_N(act));
+                values.push_back(token);
+                if (!check())
+                    return false;
+                read();
+                break;
+            case lr_reduce: {
+                auto& p = lr.productions[LR_ACTION_N(act)];
+                auto begin = values.size() - p.rhs.size();
+                auto i = begin;
+                ast_node* node;
+                if (p.recursive) { // 左递归并入同一结点
+                    node = values[i++];
+                }
+                else {
+                    node = ast->new_node(ast_collection);
+                    node->line = node->column = 0;
+                    node->data._coll = p.coll;
+                }
+                for (; i < values.size(); ++i) {
+                    auto s = p.rhs[i - begin];
+                    if (s < lr.terminals) {
+                        if (p.skip[i - begin])
+                            continue;
+                    }
+                    else if (p.attr & r_exp) { // 表达式规则的孩子经归约得到
+                        node->attr |= a_exp;
+                    }
+                    cast::set_child(node, values[i]);
+                }
+                states.resize(begin);
+                values.resize(begin);
+                auto jump = lr.jump[states.back() * lr.nonterminals + p.rule];
+                if (jump == -1)
+                    return false;
+                states.push_back(jump);
+                values.push_back(node);
+                if (!check())
+                    return false;
+            }
+                            break;
+            case lr_accept:
+                cast::set_child(ast->get_root(), values.back());
+                return true;
+            default:
+#if TRACE_PARSING
+                std::cout << "lr parsing error, state: " << state << std::endl;
+#endif
+                return false;
+            }
+        }
+    }
+
+    int cparser::lr_terminal(ast_node * node) {
+        int key;
+        if (node->flag == ast_keyword)
+            key = l_keyword << 16 | node->data._keyword;
+        else if (node->flag == ast_operator)
+            key = l_operator << 16 | node->data._op;
+        else
+            key = cast::ast_lexer((ast_t)node->flag) << 16;
+        auto f = lr_terminals.find(key);
+        return f == lr_terminals.end() ? -1 : f->second;
+    }
+
     ast_node* cparser::terminal() {
         if (lexer->is_type(l_end) && ast_cache_index >= ast_cache.size()) { // 结尾
             error("unexpected token EOF of expression");
@@ -725,18 +941,8 @@ namespace clib {
     }
 
     bool cparser::valid_trans(const pda_trans & trans) const {
-        auto& la = trans.LA;
-        if (!la.empty()) {
-            auto success = false;
-            for (auto& _la : la) {
-                if (LA(_la)) {
-                    success = true;
-                    break;
-                }
-            }
-            if (!success)
-                return false;
-        }
+        if (!trans.LA.empty() && !trans.LA_set.test(la_current))
+            return false;
         switch (trans.type) {
         case e_reduce:
         case e_reduce_exp: {
@@ -766,7 +972,6 @@ namespace clib {
             ATLTRACE("[DEBUG] Shift: top=%p, new=%p, CS=%d\n", ast_stack.back(), new_node,
                 cast::children_size(ast_stack.back()));
 #endif
-            ast_coll_cache.push_back(new_node);
             ast_stack.push_back(new_node);
         }
                       break;
@@ -827,23 +1032,21 @@ namespace clib {
         }
     }
 
-    bool cparser::LA(struct unit* u) const {
-        if (u->t != u_token)
-            return false;
-        auto token = to_token(u);
+    int cparser::la_token() const {
         if (ast_cache_index < ast_cache.size()) {
             auto& cache = ast_cache[ast_cache_index];
-            if (token->type == l_keyword)
-                return cache->flag == ast_keyword && cache->data._keyword == token->value.keyword;
-            if (token->type == l_operator)
-                return cache->flag == ast_operator && cache->data._op == token->value.op;
-            return cast::ast_equal((ast_t)cache->flag, token->type);
+            if (cache->flag == ast_keyword)
+                return clib::la_token(l_keyword, cache->data._keyword);
+            if (cache->flag == ast_operator)
+                return clib::la_token(l_operator, cache->data._op);
+            return clib::la_token(cast::ast_lexer((ast_t)cache->flag), 0);
         }
-        if (token->type == l_keyword)
-            return lexer->is_keyword(token->value.keyword);
-        if (token->type == l_operator)
-            return lexer->is_operator(token->value.op);
-        return lexer->is_type(token->type);
+        auto type = lexer->get_type();
+        if (type == l_keyword)
+            return clib::la_token(type, lexer->get_keyword());
+        if (type == l_operator)
+            return clib::la_token(type, lexer->get_operator());
+        return clib::la_token(type, 0);
     }
 
     void cparser::expect(bool flag, const string_t & info) {
@@ -26,21 +26,56 @@ namespace clib {
         std::vector<int> state_stack;
         std::vector<ast_node*> ast_stack;
         int current_state;
-        uint coll_index;
+        cast::mark_t coll_mark;
         uint reduce_index;
         std::vector<int> trans_ids;
         std::unordered_set<int> ast_ids;
         backtrace_direction direction;
     };
 
+    // 单次分析的统计，parse时清零
+    struct cparser_stat_t {
+        int tokens{ 0 };
+        int backtracks{ 0 }; // 回溯分析压入的快照数
+        int ast_nodes{ 0 };
+        size_t ast_bytes{ 0 };
+        bool lr{ false }; // LALR(1)分析成功，未回退
+        double lexer_time{ 0 }; // 秒，仅LEXER_TIME开启时统计
+    };
+
     class csemantic {
     public:
         virtual backtrace_direction check(pda_edge_t, ast_node*) = 0;
+        virtual bool is_type(const string_t&) { return false; }
+        // LR分析失败改用回溯分析前，撤销check中做过的修改
+        virtual void snapshot() {}
+        virtual void restore() {}
+    };
+
+    // 文法与分析表，构造后只读，所有分析器共享
+    class cgrammar {
+    public:
+        static const cgrammar& singleton();
+
+        const cunit& get_unit() const;
+        const std::unordered_map<int, int>& get_lr_terminals() const;
+
+    private:
+        cgrammar();
+
+        cgrammar(const cgrammar&) = delete;
+        cgrammar& operator=(const cgrammar&) = delete;
+
+        void gen();
+
+    private:
+        cunit unit;
+        std::unordered_map<int, int> lr_terminals;
     };
 
     class cparser {
     public:
-        cparser() = default;
+        cparser();
         ~cparser() = default;
 
         cparser(const cparser&) = delete;
@@ -49,17 +84,19 @@ namespace clib {
         ast_node* parse(const string_t& str, csemantic* s = nullptr);
         ast_node* root() const;
         void clear_ast();
+        const cparser_stat_t& get_stat() const;
 
     private:
         void next();
 
-        void gen();
         void program();
+        bool program_lr();
+        int lr_terminal(ast_node* node);
         ast_node* terminal();
 
         bool valid_trans(const pda_trans& trans) const;
         void do_trans(int state, backtrace_t& bk, const pda_trans& trans);
-        bool LA(unit* u) const;
+        int la_token() const;
 
     private:
         void expect(bool, const string_t&);
@@ -77,11 +114,13 @@ namespace clib {
         std::vector<ast_node*> ast_stack;
         std::vector<ast_node*> ast_cache;
         uint ast_cache_index{ 0 };
-        std::vector<ast_node*> ast_coll_cache;
         std::vector<ast_node*> ast_reduce_cache;
+        int la_current{ -1 };
+        cparser_stat_t stat;
 
     private:
-        cunit unit;
+        const cunit& unit;
+        const std::unordered_map<int, int>& lr_terminals;
         std::unique_ptr<clexer> lexer;
         csemantic* semantic{ nullptr };
         std::unique_ptr<cast> ast;
@@ -9,12 +9,15 @@
 #include <queue>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <tuple>
 #include "cunit.h"
 #include "cexception.h"
 
 #define SHOW_RULE 0
 #define SHOW_LABEL 0
 #define SHOW_CLOSURE 0
+#define SHOW_LR_CONFLICT 0
 
 #define IS_SEQ(type) (type == u_sequence)
 #define IS_BRANCH(type) (type == u_branch)
@@ -42,6 +45,22 @@ namespace clib {
         return (unit_collection*)u;
     }
 
+    static_assert(LA_TOKEN_SIZE <= LA_MAX_TOKEN, "too many lookahead tokens");
+
+    int la_token(lexer_t type, int value) {
+        if (type == l_keyword)
+            return LA_KEYWORD_BASE + value;
+        if (type == l_operator)
+            return LA_OPERATOR_BASE + value;
+        return (int)type;
+    }
+
+    int la_token(unit * u) {
+        auto t = to_token(u);
+        return la_token(t->type, t->type == l_keyword ? (int)t->value.keyword :
+            (t->type == l_operator ? (int)t->value.op : 0));
+    }
+
     unit& unit::operator=(const unit & u) {
         auto rule = to_rule(this);
         rule->child = builder->copy(const_cast<unit*>(&u));
@@ -317,6 +336,7 @@ namespace clib {
     }
 
     void cunit::gen(unit * root) {
+        gen_lr(root); // 生成NGA时会改动文法单元，须先展开
         gen_nga();
         check_nga();
         gen_pda(root);
@@ -1114,16 +1134,717 @@ namespace clib {
                         trans.status = -1;
                     }
                     std::copy(std::begin(LA[edge]), std::end(LA[edge]), std::back_inserter(trans.LA));
+                    for (auto& la : trans.LA)
+                        trans.LA_set.set(la_token(la));
                     p.trans.push_back(trans);
                 }
             }
         }
     }
 
+    // ---------------- LALR(1) ----------------
+    // 将EBNF展开为产生式，构造LR(0)项目集族，再用传播法求LALR(1)向前看集合
+
+    using lr_set = std::bitset<LR_MAX_TERMINALS>;
+
+    static int lr_value(unit_token * t) {
+        return t->type == l_keyword ? (int)t->value.keyword :
+            (t->type == l_operator ? (int)t->value.op : 0);
+    }
+
+    void cunit::gen_lr(unit * root) {
+        lr = lr_table();
+        auto size = (int)rules.size();
+        std::vector<nga_rule*> rules_list(size);
+        for (auto& rule : rules)
+            rules_list[rule.second.id] = &rule.second;
+        // 终结符，0号为结束符
+        std::map<std::tuple<int, int, bool>, int> terms;
+        lr.symbols.push_back({ l_end, 0, false });
+        terms.insert(std::make_pair(std::make_tuple((int)l_end, 0, false), 0));
+        auto term = [&](unit_token* t, bool type_name) {
+            auto key = std::make_tuple((int)t->type, lr_value(t), type_name);
+            auto f = terms.find(key);
+            if (f != terms.end())
+                return f->second;
+            auto id = (int)lr.symbols.size();
+            lr.symbols.push_back({ t->type, lr_value(t), type_name });
+            terms.insert(std::make_pair(key, id));
+            if (type_name)
+                lr.type_name = id;
+            return id;
+        };
+        // 展开后的候选式：终结符为非负数，非终结符为-(规则+1)
+        using alt_t = std::vector<std::pair<int, bool>>;
+        std::function<std::vector<alt_t>(unit*, bool)> expand;
+        expand = [&](unit* u, bool type_name) -> std::vector<alt_t> {
+            std::vector<alt_t> v;
+            switch (u->t) {
+            case u_token:
+                v.push_back({ { term(to_token(u), false), false } });
+                break;
+            case u_token_ref: {
+                auto t = to_token(to_ref(u)->child);
+                v.push_back({ { term(t, type_name && t->type == l_identifier), to_ref(u)->skip } });
+            }
+                              break;
+            case u_rule_ref:
+                v.push_back({ { -(rules[to_rule(to_ref(u)->child)->s].id + 1), false } });
+                break;
+            case u_sequence: {
+                v.emplace_back();
+                for (auto& c : get_children(to_collection(u)->child)) {
+                    auto sub = expand(c, type_name);
+                    std::vector<alt_t> w;
+                    for (auto& a : v) {
+                        for (auto& b : sub) {
+                            auto n = a;
+                            n.insert(n.end(), b.begin(), b.end());
+                            w.push_back(n);
+                        }
+                    }
+                    if (w.size() > LR_MAX_ALTS)
+                        error("lr: too many alternatives, rule: " + string_t(current_rule->s));
+                    v = std::move(w);
+                }
+            }
+                             break;
+            case u_branch:
+                for (auto& c : get_children(to_collection(u)->child)) {
+                    auto sub = expand(c, type_name);
+                    v.insert(v.end(), sub.begin(), sub.end());
+                }
+                break;
+            case u_optional:
+                v = expand(to_collection(u)->child, type_name);
+                v.emplace_back();
+                break;
+            default:
+                error("lr: invalid unit type");
+                break;
+            }
+            return v;
+        };
+        lr.productions.push_back({ -1, c_program, 0, false, { -(rules[to_rule(root)->s].id + 1) }, { false } });
+        for (auto i = 0; i < size; ++i) {
+            current_rule = rules_list[i]->u;
+            std::vector<alt_t> alts;
+            for (auto& a : expand(current_rule->child, (current_rule->attr & r_type_name) != 0)) {
+                if (std::find(alts.begin(), alts.end(), a) == alts.end())
+                    alts.push_back(a);
+            }
+            for (auto& a : alts) {
+                lr_production p;
+                p.rule = i;
+                p.coll = rulesMap[current_rule->s];
+                p.attr = current_rule->attr;
+                for (auto& s : a) {
+                    p.rhs.push_back(s.first);
+                    p.skip.push_back(s.second);
+                }
+                if (p.rhs.size() == 1 && p.rhs[0] == -(i + 1))
+                    continue; // A -> A
+                p.recursive = !p.rhs.empty() && p.rhs[0] == -(i + 1);
+                lr.productions.push_back(p);
+            }
+        }
+        current_rule = nullptr;
+        auto T = (int)lr.symbols.size();
+        if (T >= LR_MAX_TERMINALS)
+            error("lr: too many terminals");
+        auto N = size + 1; // 含增广开始符
+        lr.terminals = T;
+        lr.nonterminals = N;
+        for (auto& s : lr.symbols) {
+            if (s.type == l_identifier && !s.type_name)
+                lr.identifier = (int)(&s - &lr.symbols[0]);
+        }
+        auto P = (int)lr.productions.size();
+        std::vector<std::vector<int>> prods_of(N);
+        for (auto i = 0; i < P; ++i) {
+            auto& p = lr.productions[i];
+            if (p.rule == -1)
+                p.rule = size;
+            for (auto& s : p.rhs) {
+                if (s < 0)
+                    s = T + (-s - 1);
+            }
+            prods_of[p.rule].push_back(i);
+        }
+        // FIRST与可空
+        std::vector<lr_set> first(N);
+        std::vector<bool> nullable(N);
+        for (auto changed = true; changed;) {
+            changed = false;
+            for (auto& p : lr.productions) {
+                auto A = p.rule;
+                auto f = first[A];
+                auto all = true;
+                for (auto& s : p.rhs) {
+                    if (s < T) {
+                        f.set(s);
+                        all = false;
+                        break;
+                    }
+                    f |= first[s - T];
+                    if (!nullable[s - T]) {
+                        all = false;
+                        break;
+                    }
+                }
+                if (f != first[A]) {
+                    first[A] = f;
+                    changed = true;
+                }
+                if (all && !nullable[A]) {
+                    nullable[A] = true;
+                    changed = true;
+                }
+            }
+        }
+        // 项目编号
+        std::vector<int> item_base(P + 1);
+        for (auto i = 0; i < P; ++i)
+            item_base[i + 1] = item_base[i] + (int)lr.productions[i].rhs.size() + 1;
+        auto items = item_base[P];
+        std::vector<int> item_prod(items), item_dot(items);
+        std::vector<lr_set> item_first(items); // 点后第二个符号起的FIRST
+        std::vector<bool> item_nullable(items);
+        for (auto i = 0; i < P; ++i) {
+            auto& rhs = lr.productions[i].rhs;
+            auto len = (int)rhs.size();
+            for (auto d = len; d >= 0; --d) {
+                auto it = item_base[i] + d;
+                item_prod[it] = i;
+                item_dot[it] = d;
+                if (d + 1 >= len) {
+                    item_nullable[it] = true;
+                    continue;
+                }
+                auto s = rhs[d + 1];
+                if (s < T) {
+                    item_first[it].set(s);
+                    item_nullable[it] = false;
+                }
+                else {
+                    item_first[it] = first[s - T];
+                    if (nullable[s - T]) {
+                        item_first[it] |= item_first[it + 1];
+                        item_nullable[it] = item_nullable[it + 1];
+                    }
+                    else {
+                        item_nullable[it] = false;
+                    }
+                }
+            }
+        }
+        auto next_symbol = [&](int it) {
+            auto& rhs = lr.productions[item_prod[it]].rhs;
+            return item_dot[it] < (int)rhs.size() ? rhs[item_dot[it]] : -1;
+        };
+        // LR(0) 项目集族
+        auto S = T + N;
+        std::vector<std::vector<int>> kernels;
+        std::map<std::vector<int>, int> kernel_ids;
+        std::vector<std::vector<int>> gotos;
+        std::vector<char> mark(items);
+        kernels.push_back({ item_base[0] });
+        kernel_ids.insert(std::make_pair(kernels[0], 0));
+        for (size_t i = 0; i < kernels.size(); ++i) {
+            std::vector<int> closure = kernels[i];
+            std::fill(mark.begin(), mark.end(), 0);
+            for (auto& it : closure)
+                mark[it] = 1;
+            for (size_t j = 0; j < closure.size(); ++j) {
+                auto s = next_symbol(closure[j]);
+                if (s >= T) {
+                    for (auto& q : prods_of[s - T]) {
+                        if (!mark[item_base[q]]) {
+                            mark[item_base[q]] = 1;
+                            closure.push_back(item_base[q]);
+                        }
+                    }
+                }
+            }
+            std::map<int, std::vector<int>> moves;
+            for (auto& it : closure) {
+                auto s = next_symbol(it);
+                if (s != -1)
+                    moves[s].push_back(it + 1);
+            }
+            std::vector<int> go(S, -1);
+            for (auto& m : moves) {
+                std::sort(m.second.begin(), m.second.end());
+                auto f = kernel_ids.find(m.second);
+                if (f == kernel_ids.end()) {
+                    f = kernel_ids.insert(std::make_pair(m.second, (int)kernels.size())).first;
+                    kernels.push_back(m.second);
+                }
+                go[m.first] = f->second;
+            }
+            gotos.push_back(std::move(go));
+        }
+        auto K = (int)kernels.size();
+        lr.states = K;
+        // 核心项目的向前看集合，T号位为传播标记
+        auto find_kernel = [&](int state, int it) {
+            auto& k = kernels[state];
+            return (int)(std::lower_bound(k.begin(), k.end(), it) - k.begin());
+        };
+        std::vector<int> kernel_base(K + 1);
+        for (auto i = 0; i < K; ++i)
+            kernel_base[i + 1] = kernel_base[i] + (int)kernels[i].size();
+        std::vector<lr_set> la(kernel_base[K]);
+        std::vector<std::vector<int>> propagate(kernel_base[K]);
+        auto closure1 = [&](const std::vector<std::pair<int, lr_set>>& seed) {
+            std::unordered_map<int, lr_set> c;
+            std::vector<int> queue;
+            auto add = [&](int it, const lr_set& s) {
+                auto f = c.find(it);
+                if (f == c.end()) {
+                    c.insert(std::make_pair(it, s));
+                    queue.push_back(it);
+                }
+                else if ((f->second | s) != f->second) {
+                    f->second |= s;
+                    queue.push_back(it);
+                }
+            };
+            for (auto& s : seed)
+                add(s.first, s.second);
+            while (!queue.empty()) {
+                auto it = queue.back();
+                queue.pop_back();
+                auto s = next_symbol(it);
+                if (s < T)
+                    continue;
+                auto f = item_first[it];
+                if (item_nullable[it])
+                    f |= c[it];
+                for (auto& q : prods_of[s - T])
+                    add(item_base[q], f);
+            }
+            return c;
+        };
+        la[0].set(0);
+        for (auto i = 0; i < K; ++i) {
+            for (size_t j = 0; j < kernels[i].size(); ++j) {
+                lr_set hash;
+                hash.set(T);
+                auto kid = kernel_base[i] + (int)j;
+                for (auto& c : closure1({ { kernels[i][j], hash } })) {
+                    auto s = next_symbol(c.first);
+                    if (s == -1)
+                        continue;
+                    auto t = gotos[i][s];
+                    auto target = kernel_base[t] + find_kernel(t, c.first + 1);
+                    auto l = c.second;
+                    if (l.test(T)) {
+                        propagate[kid].push_back(target);
+                        l.reset(T);
+                    }
+                    la[target] |= l;
+                }
+            }
+        }
+        for (auto changed = true; changed;) {
+            changed = false;
+            for (size_t i = 0; i < la.size(); ++i) {
+                for (auto& t : propagate[i]) {
+                    if ((la[t] | la[i]) != la[t]) {
+                        la[t] |= la[i];
+                        changed = true;
+                    }
+                }
+            }
+        }
+#if SHOW_LR_CONFLICT
+        auto prod_str = [&](int p) {
+            std::stringstream ss;
+            auto& prod = lr.productions[p];
+            ss << (prod.rule < size ? rules_list[prod.rule]->u->s : "S'") << " ->";
+            for (auto& s : prod.rhs) {
+                if (s >= T)
+                    ss << " " << (s - T < size ? rules_list[s - T]->u->s : "S'");
+                else if (lr.symbols[s].type == l_keyword)
+                    ss << " " << KEYWORD_STRING((keyword_t)lr.symbols[s].value);
+                else if (lr.symbols[s].type == l_operator)
+                    ss << " " << OP_STRING((operator_t)lr.symbols[s].value);
+                else
+                    ss << " #" << (lr.symbols[s].type == l_end ? "$" : LEX_STRING(lr.symbols[s].type));
+            }
+            return ss.str();
+        };
+#endif
+        // 优先级声明，指定向前看记号的优先于通配的
+        auto find_precedence = [&](int rule, const lr_symbol& sym) -> const lr_precedence* {
+            const lr_precedence* any = nullptr;
+            for (auto& pr : precedences) {
+                if (pr.rule != rule)
+                    continue;
+                if (pr.type == l_none)
+                    any = &pr;
+                else if (pr.type == sym.type && pr.value == sym.value)
+                    return &pr;
+            }
+            return any;
+        };
+        // 填表
+        lr.action.assign((size_t)K * T, LR_ACTION(lr_error, 0));
+        lr.jump.assign((size_t)K * N, -1);
+        lr.semantic.assign(K, -1);
+        for (auto i = 0; i < K; ++i) {
+            for (auto s = 0; s < T; ++s) {
+                if (gotos[i][s] != -1)
+                    lr.action[i * T + s] = LR_ACTION(lr_shift, gotos[i][s]);
+            }
+            for (auto s = 0; s < N; ++s)
+                lr.jump[i * N + s] = gotos[i][T + s];
+            std::vector<std::pair<int, lr_set>> seed;
+            for (size_t j = 0; j < kernels[i].size(); ++j) {
+                auto it = kernels[i][j];
+                seed.push_back({ it, la[kernel_base[i] + j] });
+                auto& p = lr.productions[item_prod[it]];
+                if ((p.attr & r_semantic) && item_dot[it] > 0)
+                    lr.semantic[i] = item_prod[it] << 8 | item_dot[it];
+            }
+            for (auto& c : closure1(seed)) {
+                if (next_symbol(c.first) != -1)
+                    continue;
+                auto p = item_prod[c.first];
+                for (auto s = 0; s < T; ++s) {
+                    if (!c.second.test(s))
+                        continue;
+                    auto& act = lr.action[i * T + s];
+                    auto a = p == 0 ? LR_ACTION(lr_accept, 0) : LR_ACTION(lr_reduce, p);
+                    if (LR_ACTION_TYPE(act) == lr_error) {
+                        act = a;
+                        continue;
+                    }
+                    if (act == a)
+                        continue;
+                    // 冲突，按优先级声明裁决
+                    auto& sym = lr.symbols[s];
+                    auto resolved = true;
+                    const lr_precedence* pr;
+                    if (LR_ACTION_TYPE(act) == lr_reduce &&
+                        lr.productions[LR_ACTION_N(act)].rule == lr.productions[p].rule &&
+                        lr.productions[LR_ACTION_N(act)].rhs.size() != lr.productions[p].rhs.size()) {
+                        // 同一规则，取较长的产生式，与回溯分析的贪婪匹配一致
+                        if (lr.productions[p].rhs.size() > lr.productions[LR_ACTION_N(act)].rhs.size())
+                            act = a;
+                    }
+                    else if ((pr = find_precedence(lr.productions[p].rule, sym)) != nullptr) {
+                        if (pr->reduce)
+                            act = a;
+                    }
+                    else if (LR_ACTION_TYPE(act) == lr_reduce &&
+                        (pr = find_precedence(lr.productions[LR_ACTION_N(act)].rule, sym)) != nullptr) {
+                        if (!pr->reduce)
+                            act = a;
+                    }
+                    else {
+                        resolved = false;
+                    }
+                    if (!resolved) {
+                        lr.conflicts++;
+#if SHOW_LR_CONFLICT
+                        std::cout << "LR conflict: state #" << i << ", " << (sym.type == l_end ? "$" : LEX_STRING(sym.type)) << " "
+                            << (sym.type == l_keyword ? KEYWORD_STRING((keyword_t)sym.value) :
+                                (sym.type == l_operator ? OP_STRING((operator_t)sym.value) : ""))
+                            << (sym.type_name ? " (type)" : "") << ", "
+                            << (LR_ACTION_TYPE(act) == lr_shift ? "shift" : "reduce " + prod_str(LR_ACTION_N(act)))
+                            << " / reduce " << prod_str(p) << std::endl;
+#endif
+                    }
+                }
+            }
+        }
+        ATLTRACE("[SYSTEM] LR    | Terminals: %d, Nonterminals: %d, Productions: %d, States: %d, Conflicts: %d\n",
+            T, N, P, K, lr.conflicts);
+    }
+
+    const lr_table& cunit::get_lr() const {
+        return lr;
+    }
+
+    void cunit::precedence(const unit & rule, const unit & la, bool reduce) {
+        auto t = to_token(const_cast<unit*>(&la));
+        precedences.push_back({ rules[to_rule(const_cast<unit*>(&rule))->s].id, t->type, lr_value(t), reduce });
+    }
+
+    void cunit::precedence(const unit & rule, bool reduce) {
+        precedences.push_back({ rules[to_rule(const_cast<unit*>(&rule))->s].id, l_none, 0, reduce });
+    }
+
     const std::vector<pda_rule>& cunit::get_pda() const {
         return pdas;
     }
 
+    static void write_int(std::ostream & os, int n) {
+        os.write((const char*)& n, sizeof(n));
+    }
+
+    static void write_str(std::ostream & os, const string_t & s) {
+        write_int(os, (int)s.length());
+        os.write(s.data(), s.length());
+    }
+
+    static bool read_int(std::istream & is, int& n) {
+        return (bool)is.read((char*)& n, sizeof(n));
+    }
+
+    static bool read_str(std::istream & is, string_t & s) {
+        int n;
+        if (!read_int(is, n) || n < 0 || n > 0x10000)
+            return false;
+        s.resize((size_t)n);
+        return n == 0 || (bool)is.read(&s[0], n);
+    }
+
+    static void write_ints(std::ostream & os, const std::vector<int> & v) {
+        write_int(os, (int)v.size());
+        if (!v.empty())
+            os.write((const char*)v.data(), v.size() * sizeof(int));
+    }
+
+    static bool read_ints(std::istream & is, std::vector<int> & v, size_t size) {
+        int n;
+        if (!read_int(is, n) || n < 0 || (size_t)n != size)
+            return false;
+        v.resize(size);
+        return n == 0 || (bool)is.read((char*)v.data(), size * sizeof(int));
+    }
+
+    static void sign(uint64 & h, uint64 n) { // FNV-1a
+        for (auto i = 0; i < 8; ++i) {
+            h ^= (n >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+    }
+
+    static void sign(uint64 & h, const char* s) {
+        for (; *s; ++s) {
+            h ^= (byte)* s;
+            h *= 1099511628211ULL;
+        }
+        sign(h, (uint64)0);
+    }
+
+    static void sign(uint64 & h, unit * node) {
+        if (node == nullptr) {
+            sign(h, u_none);
+            return;
+        }
+        sign(h, node->t);
+        switch (node->t) {
+        case u_token: {
+            auto t = to_token(node);
+            sign(h, t->type);
+            sign(h, t->type == l_keyword ? (uint64)t->value.keyword :
+                (t->type == l_operator ? (uint64)t->value.op : 0));
+        }
+                      break;
+        case u_token_ref:
+            sign(h, to_ref(node)->skip ? 1 : 0);
+            sign(h, to_ref(node)->child);
+            break;
+        case u_rule_ref:
+            sign(h, to_rule(to_ref(node)->child)->s);
+            break;
+        case u_sequence:
+        case u_branch:
+        case u_optional: {
+            auto child = to_collection(node)->child;
+            auto i = child;
+            do {
+                sign(h, i);
+                i = i ? i->next : nullptr;
+            } while (i && i != child);
+            sign(h, u_none);
+        }
+                         break;
+        default:
+            break;
+        }
+    }
+
+    // 文法及表中用到的枚举值的签名，用作缓存表的校验
+    string_t cunit::signature() const {
+        uint64 h = 14695981039346656037ULL;
+        sign(h, PDA_TABLE_VERSION);
+        sign(h, l_end);
+        sign(h, k__end);
+        sign(h, op__end);
+        sign(h, c__end);
+        for (auto& r : rules) {
+            auto u = r.second.u;
+            sign(h, u->s);
+            sign(h, rulesMap.at(u->s));
+            sign(h, u->attr);
+            sign(h, u->child);
+        }
+        for (auto& p : precedences) {
+            sign(h, p.rule);
+            sign(h, p.type);
+            sign(h, p.value);
+            sign(h, p.reduce ? 1 : 0);
+        }
+        char s[32];
+        snprintf(s, sizeof(s), "%016llX", (unsigned long long)h);
+        return s;
+    }
+
+    // 表的有效性由文法签名决定，文法、枚举或算法修改后自动失效
+    void cunit::save(std::ostream & os, const string_t & stamp) const {
+        os.write(PDA_TABLE_MAGIC, 4);
+        write_str(os, stamp);
+        write_int(os, (int)pdas.size());
+        for (auto& pda : pdas) {
+            write_int(os, pda.rule);
+            write_int(os, pda.final ? 1 : 0);
+            write_int(os, (int)pda.coll);
+            write_str(os, pda.label);
+            write_int(os, (int)pda.trans.size());
+            for (auto& trans : pda.trans) {
+                write_int(os, trans.jump);
+                write_int(os, (int)trans.type);
+                write_int(os, trans.status);
+                write_str(os, trans.label);
+                write_int(os, (int)trans.LA.size());
+                for (auto& la : trans.LA) {
+                    auto token = to_token(la);
+                    write_int(os, (int)token->type);
+                    write_int(os, token->type == l_keyword ? (int)token->value.keyword :
+                        (token->type == l_operator ? (int)token->value.op : 0));
+                }
+            }
+        }
+        // LALR(1) 分析表
+        write_int(os, lr.terminals);
+        write_int(os, lr.nonterminals);
+        write_int(os, lr.states);
+        write_int(os, lr.conflicts);
+        write_int(os, lr.type_name);
+        write_int(os, lr.identifier);
+        for (auto& s : lr.symbols) {
+            write_int(os, (int)s.type);
+            write_int(os, s.value);
+            write_int(os, s.type_name ? 1 : 0);
+        }
+        write_int(os, (int)lr.productions.size());
+        for (auto& p : lr.productions) {
+            write_int(os, p.rule);
+            write_int(os, (int)p.coll);
+            write_int(os, (int)p.attr);
+            write_int(os, p.recursive ? 1 : 0);
+            write_ints(os, p.rhs);
+            for (auto s : p.skip)
+                write_int(os, s ? 1 : 0);
+        }
+        write_ints(os, lr.action);
+        write_ints(os, lr.jump);
+        write_ints(os, lr.semantic);
+    }
+
+    bool cunit::load(std::istream & is, const string_t & stamp) {
+        char magic[4];
+        string_t s;
+        int size;
+        if (!is.read(magic, sizeof(magic)) || std::memcmp(magic, PDA_TABLE_MAGIC, sizeof(magic)) != 0)
+            return false;
+        if (!read_str(is, s) || s != stamp)
+            return false;
+        if (!read_int(is, size) || size <= 0)
+            return false;
+        std::vector<pda_rule> _pdas((size_t)size);
+        std::map<std::pair<int, int>, unit*> tokens; // 相同的向前看记号共用一个单元
+        for (auto i = 0; i < size; ++i) {
+            auto& pda = _pdas[i];
+            int final, coll, n;
+            pda.id = i;
+            if (!read_int(is, pda.rule) || !read_int(is, final) || !read_int(is, coll) ||
+                !read_str(is, pda.label) || !read_int(is, n) || n < 0)
+                return false;
+            pda.final = final != 0;
+            pda.coll = (coll_t)coll;
+            pda.trans.resize((size_t)n);
+            for (auto& trans : pda.trans) {
+                int type, la;
+                if (!read_int(is, trans.jump) || !read_int(is, type) || !read_int(is, trans.status) ||
+                    !read_str(is, trans.label) || !read_int(is, la) || la < 0)
+                    return false;
+                if (trans.jump < 0 || trans.jump >= size || type < e_shift || type > e_finish)
+                    return false;
+                trans.type = (pda_edge_t)type;
+                for (auto j = 0; j < la; ++j) {
+                    int t, v;
+                    if (!read_int(is, t) || !read_int(is, v))
+                        return false;
+                    auto f = tokens.find(std::make_pair(t, v));
+                    if (f == tokens.end()) {
+                        unit* u;
+                        if (t == l_keyword)
+                            u = &token((keyword_t)v);
+                        else if (t == l_operator)
+                            u = &token((operator_t)v);
+                        else
+                            u = &token((lexer_t)t);
+                        f = tokens.insert(std::make_pair(std::make_pair(t, v), u)).first;
+                    }
+                    trans.LA.push_back(f->second);
+                    trans.LA_set.set(la_token(f->second));
+                }
+            }
+        }
+        lr_table _lr;
+        int n;
+        if (!read_int(is, _lr.terminals) || !read_int(is, _lr.nonterminals) || !read_int(is, _lr.states) ||
+            !read_int(is, _lr.conflicts) || !read_int(is, _lr.type_name) || !read_int(is, _lr.identifier))
+            return false;
+        auto T = _lr.terminals, N = _lr.nonterminals, K = _lr.states;
+        if (T < 0 || T >= LR_MAX_TERMINALS || N < 0 || K < 0 || _lr.type_name >= T || _lr.identifier >= T)
+            return false;
+        _lr.symbols.resize(T);
+        for (auto& s : _lr.symbols) {
+            int type, type_name;
+            if (!read_int(is, type) || !read_int(is, s.value) || !read_int(is, type_name))
+                return false;
+            s.type = (lexer_t)type;
+            s.type_name = type_name != 0;
+        }
+        if (!read_int(is, n) || n < 0)
+            return false;
+        _lr.productions.resize(n);
+        for (auto& p : _lr.productions) {
+            int coll, attr, recursive, len;
+            if (!read_int(is, p.rule) || !read_int(is, coll) || !read_int(is, attr) ||
+                !read_int(is, recursive) || !read_int(is, len) || len < 0 || len > 0x100)
+                return false;
+            if (p.rule < 0 || p.rule >= N)
+                return false;
+            p.coll = (coll_t)coll;
+            p.attr = (uint32)attr;
+            p.recursive = recursive != 0;
+            p.rhs.resize(len);
+            if (len > 0 && !is.read((char*)p.rhs.data(), len * sizeof(int)))
+                return false;
+            for (auto& s : p.rhs) {
+                if (s < 0 || s >= T + N)
+                    return false;
+                if (!read_int(is, n))
+                    return false;
+                p.skip.push_back(n != 0);
+            }
+        }
+        if (!read_ints(is, _lr.action, (size_t)K * T) || !read_ints(is, _lr.jump, (size_t)K * N) ||
+            !read_ints(is, _lr.semantic, (size_t)K))
+            return false;
+        pdas = std::move(_pdas);
+        lr = std::move(_lr);
+        return true;
+    }
+
     void print(nga_status * node, std::ostream & os) {
         if (node == nullptr)
             return;
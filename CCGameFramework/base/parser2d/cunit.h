@@ -14,6 +14,15 @@
 #include "memory.h"
 
 #define UNIT_NODE_MEM (32 * 1024)
+#define PDA_TABLE_MAGIC "cpda"
+#define PDA_TABLE_VERSION 1 // 表的生成算法或存储格式变化时递增
+#define LR_MAX_TERMINALS 256
+// 向前看记号统一编号：词法类型、关键字、操作符依次排列
+#define LA_KEYWORD_BASE ((int)l_end + 1)
+#define LA_OPERATOR_BASE (LA_KEYWORD_BASE + (int)k__end)
+#define LA_TOKEN_SIZE (LA_OPERATOR_BASE + (int)op__end)
+#define LA_MAX_TOKEN 256
+#define LR_MAX_ALTS 1024
 
 namespace clib {
 
@@ -117,6 +126,8 @@ namespace clib {
     unit_collection* to_collection(unit* u);
     unit_collection* to_ref(unit* u);
     const string_t& pda_edge_str(pda_edge_t type);
+    int la_token(lexer_t type, int value);
+    int la_token(unit* u);
     const int& pda_edge_priority(pda_edge_t type);
 
     class unit_builder {
@@ -142,12 +153,15 @@ namespace clib {
         std::unordered_set<unit_rule*> rulesFirstset;
     };
 
+    using la_set = std::bitset<LA_MAX_TOKEN>;
+
     struct pda_trans {
         int jump;
         pda_edge_t type;
         int status;
         string_t label;
         std::vector<unit*> LA;
+        la_set LA_set; // 由LA预先算出
     };
 
     struct pda_rule {
@@ -163,6 +177,56 @@ namespace clib {
         r_normal = 0,
         r_not_greed = 1,
         r_exp = 2,
+        r_type_name = 4, // 规则内的标识符须由语义确认为类型名
+        r_semantic = 8, // 规则中途移进时即做语义检查
+    };
+
+    // LALR(1) 分析表
+    enum lr_action_t {
+        lr_error,
+        lr_shift,
+        lr_reduce,
+        lr_accept,
+    };
+
+#define LR_ACTION(type, n) (((n) << 2) | (type))
+#define LR_ACTION_TYPE(act) ((lr_action_t)((act) & 3))
+#define LR_ACTION_N(act) ((act) >> 2)
+
+    struct lr_symbol {
+        lexer_t type;
+        int value;
+        bool type_name;
+    };
+
+    struct lr_production {
+        int rule; // 左部，-1为增广开始符
+        coll_t coll;
+        uint32 attr;
+        bool recursive; // 左递归，归约时并入首个孩子
+        std::vector<int> rhs; // 小于terminals的为终结符
+        std::vector<bool> skip;
+    };
+
+    struct lr_precedence {
+        int rule; // 归约规则
+        lexer_t type; // 向前看记号，l_none为任意
+        int value;
+        bool reduce; // 冲突时选择归约
+    };
+
+    struct lr_table {
+        int terminals{ 0 };
+        int nonterminals{ 0 };
+        int states{ 0 };
+        int conflicts{ 0 };
+        int type_name{ -1 }; // 类型名终结符
+        int identifier{ -1 };
+        std::vector<lr_symbol> symbols;
+        std::vector<lr_production> productions;
+        std::vector<int> action; // states * terminals
+        std::vector<int> jump; // states * nonterminals
+        std::vector<int> semantic; // 需中途语义检查的项目 (产生式 << 8 | 点)
     };
 
     // 文法表达式
@@ -190,6 +254,9 @@ namespace clib {
         nga_edge* connect(nga_status* a, nga_status* b, bool is_pda = false) override;
 
         const std::vector<pda_rule>& get_pda() const;
+        const lr_table& get_lr() const;
+        void precedence(const unit& rule, const unit& la, bool reduce);
+        void precedence(const unit& rule, bool reduce);
 
     private:
         nga_status* status();
@@ -203,11 +270,15 @@ namespace clib {
     public:
         void gen(unit* root);
         void dump(std::ostream& os);
+        string_t signature() const;
+        void save(std::ostream& os, const string_t& stamp) const;
+        bool load(std::istream& is, const string_t& stamp);
 
     private:
         void gen_nga();
         void check_nga();
         void gen_pda(unit* root);
+        void gen_lr(unit* root);
 
         static nga_edge* conv_nga(unit* u);
         nga_status* delete_epsilon(nga_edge* edge);
@@ -225,6 +296,8 @@ namespace clib {
         std::map<std::string, nga_rule> rules;
         std::unordered_map<const char*, coll_t> rulesMap;
         std::vector<pda_rule> pdas;
+        std::vector<lr_precedence> precedences;
+        lr_table lr;
         unit_rule* current_rule{ nullptr };
     };
 };
@@ -13,6 +13,63 @@
 
 namespace clib {
 
+    size_t vfs_data::size() const {
+        return length;
+    }
+
+    bool vfs_data::empty() const {
+        return length == 0;
+    }
+
+    byte vfs_data::operator[](size_t idx) const {
+        return chunks[idx / VFS_CHUNK_SIZE]->data[idx % VFS_CHUNK_SIZE];
+    }
+
+    byte* vfs_data::tail() {
+        auto off = length % VFS_CHUNK_SIZE;
+        if (off == 0 && length / VFS_CHUNK_SIZE == chunks.size())
+            chunks.push_back(std::make_shared<chunk_t>());
+        auto& c = chunks[length / VFS_CHUNK_SIZE];
+        if (c.use_count() > 1) // 共享块，写前复制
+            c = std::make_shared<chunk_t>(*c);
+        return c->data + off;
+    }
+
+    void vfs_data::push_back(byte c) {
+        *tail() = c;
+        length++;
+    }
+
+    void vfs_data::append(const byte* buf, size_t len) {
+        while (len > 0) {
+            auto p = tail();
+            auto n = min(len, (size_t)VFS_CHUNK_SIZE - length % VFS_CHUNK_SIZE);
+            std::copy(buf, buf + n, p);
+            buf += n;
+            len -= n;
+            length += n;
+        }
+    }
+
+    size_t vfs_data::read(size_t off, byte* buf, size_t len) const {
+        if (off >= length)
+            return 0;
+        len = min(len, length - off);
+        for (size_t i = 0; i < len;) {
+            const auto& c = chunks[(off + i) / VFS_CHUNK_SIZE];
+            auto o = (off + i) % VFS_CHUNK_SIZE;
+            auto n = min(len - i, (size_t)VFS_CHUNK_SIZE - o);
+            std::copy(c->data + o, c->data + o + n, buf + i);
+            i += n;
+        }
+        return len;
+    }
+
+    void vfs_data::clear() {
+        chunks.clear();
+        length = 0;
+    }
+
     void vfs_node_dec::advance() {
         if (available())
             idx++;
@@ -76,14 +133,70 @@ namespace clib {
     }
 
     vfs_node_cached::vfs_node_cached(const vfs_mod_query* mod, const string_t& str) :
-        vfs_node_dec(mod), cache(str) {}
+        vfs_node_dec(mod), cache(std::make_shared<const string_t>(str)) {}
+
+    vfs_node_cached::vfs_node_cached(const vfs_mod_query* mod, const vfs_snapshot& snapshot) :
+        vfs_node_dec(mod), cache(snapshot) {}
 
     bool vfs_node_cached::available() const {
-        return idx < cache.length();
+        return idx < cache->length();
     }
 
     int vfs_node_cached::index() const {
-        return idx < cache.length() ? cache[idx] : READ_EOF;
+        return idx < cache->length() ? (*cache)[idx] : READ_EOF;
+    }
+
+    vfs_mapping::vfs_mapping(const string_t& file) {
+        auto h = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (h == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(h, &size)) {
+            CloseHandle(h);
+            return;
+        }
+        length = (size_t)size.QuadPart;
+        if (length == 0) { // 空文件无法映射
+            CloseHandle(h);
+            ok = true;
+            return;
+        }
+        auto m = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(h);
+        if (!m)
+            return;
+        view = (const byte*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(m); // 视图保持映射
+        ok = view != nullptr;
+    }
+
+    vfs_mapping::~vfs_mapping() {
+        if (view)
+            UnmapViewOfFile(view);
+    }
+
+    bool vfs_mapping::valid() const {
+        return ok;
+    }
+
+    const byte* vfs_mapping::data() const {
+        return view;
+    }
+
+    size_t vfs_mapping::size() const {
+        return length;
+    }
+
+    vfs_node_mapped::vfs_node_mapped(const vfs_mod_query* mod, const std::shared_ptr<vfs_mapping>& map) :
+        vfs_node_dec(mod), mapping(map) {}
+
+    bool vfs_node_mapped::available() const {
+        return idx < mapping->size();
+    }
+
+    int vfs_node_mapped::index() const {
+        return idx < mapping->size() ? mapping->data()[idx] : READ_EOF;
     }
 
     vfs_node_stream::vfs_node_stream(const vfs_mod_query* mod, vfs_stream_t s, vfs_stream_call* call) :
@@ -129,17 +242,20 @@ namespace clib {
         root = new_node(fs_dir);
         mod_copy(root->mod, "rw-r--rw-"); // make '/' writable
         pwd = "/";
+        invalidate();
         auto n = now();
-        year = localtime(&n)->tm_year;
+        struct tm tm;
+        localtime_s(&tm, &n);
+        year = tm.tm_year;
         current_user = 1;
         last_user = 0;
     }
 
-    void cvfs::error(const string_t & str) {
+    void cvfs::error(const string_t & str) const {
         throw cexception(ex_vm, str);
     }
 
-    vfs_node::ref cvfs::new_node(vfs_file_t type) {
+    vfs_node::ref cvfs::new_node(vfs_file_t type) const {
         auto node = std::make_shared<vfs_node>();
         node->type = type;
         if (type == fs_file) {
@@ -160,6 +276,7 @@ namespace clib {
         node->refs = 0;
         node->locked = false;
         node->callback = nullptr;
+        node->version = -1;
         return node;
     }
 
@@ -171,8 +288,10 @@ namespace clib {
         return pwd;
     }
 
-    char* cvfs::file_time(const time_t & t) const {
-        auto timeptr = localtime(&t);
+    string_t cvfs::file_time(const time_t & t) const {
+        struct tm tm;
+        localtime_s(&tm, &t);
+        auto timeptr = &tm;
         /*static const char wday_name[][4] = {
                 "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
         };*/
@@ -180,15 +299,15 @@ namespace clib {
             "Jan", "Feb", "Mar", "Apr", "May", "Jun",
             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
         };
-        static char result[32];
+        char result[32];
         if (year == timeptr->tm_year) {
-            sprintf(result, "%.3s%3d %.2d:%.2d",
+            snprintf(result, sizeof(result), "%.3s%3d %.2d:%.2d",
                 mon_name[timeptr->tm_mon],
                 timeptr->tm_mday, timeptr->tm_hour,
                 timeptr->tm_min);
         }
         else {
-            sprintf(result, "%.3s%3d %5d",
+            snprintf(result, sizeof(result), "%.3s%3d %5d",
                 //wday_name[timeptr->tm_wday],
                 mon_name[timeptr->tm_mon],
                 timeptr->tm_mday,
@@ -206,13 +325,13 @@ namespace clib {
             "76FC44", // func
             "BCDD29", // magic
         };
-        static char fmt[256];
-        sprintf(fmt, "\033FFFA0A0A0\033%c%9s \033FFFB3B920\033%4s \033S4\033%9d \033FFF51C2A8\033%s \033FFF%s\033%s\033S4\033",
+        char fmt[256];
+        snprintf(fmt, sizeof(fmt), "\033FFFA0A0A0\033%c%9s \033FFFB3B920\033%4s \033S4\033%9zu \033FFF51C2A8\033%s \033FFF%s\033%s\033S4\033",
             node->type == fs_dir ? 'd' : '-',
             (char*)node->mod,
             account[node->owner].name.data(),
-            node->data.size(),
-            file_time(node->time.create),
+            file_size(node),
+            file_time(node->time.create).c_str(),
             types[(int)node->type],
             name.data());
         os << fmt << std::endl;
@@ -235,6 +354,7 @@ namespace clib {
     }
 
     int cvfs::macro(const std::vector<string_t> & m, const vfs_node::ref & node, vfs_node_dec * *dec) const {
+        expand(node);
         if (m[1] == "ls") {
             std::stringstream ss;
             std::transform(node->children.begin(), node->children.end(),
@@ -270,6 +390,7 @@ namespace clib {
                     continue;
                 ll(full_path(n), n, ss); // children
                 if (n->type == fs_dir) {
+                    expand(n);
                     for (auto c = n->children.rbegin(); c != n->children.rend(); c++) {
                         stacks.push_back(c->second);
                     }
@@ -297,6 +418,14 @@ namespace clib {
             if (node->locked)
                 return -3;
             node->time.access = now();
+            if (node->host) {
+                auto m = map(node);
+                if (!m)
+                    return -1;
+                if (dec)
+                    *dec = new vfs_node_mapped(this, m);
+                return 0;
+            }
             if (dec)
                 * dec = new vfs_node_solid(this, node);
             return 0;
@@ -341,8 +470,15 @@ namespace clib {
             return false;
         if (node->type != fs_file)
             return false;
+        if (node->host) {
+            auto m = map(node);
+            if (!m)
+                return false;
+            data.assign(m->data(), m->data() + m->size());
+            return true;
+        }
         data.resize(node->data.size());
-        std::copy(node->data.begin(), node->data.end(), data.begin());
+        node->data.read(0, data.data(), data.size());
         return true;
     }
 
@@ -369,26 +505,14 @@ namespace clib {
             if (!node)
                 return false;
         }
-        if (node->type != fs_file)
+        if (node->type != fs_file || node->host)
             return false;
         if (!node->data.empty())
             return false;
-        node->data.resize(data.size());
-        std::copy(data.begin(), data.end(), node->data.begin());
+        node->data.append(data.data(), data.size());
         return true;
     }
 
-    string_t get_parent(const string_t & path) {
-        assert(path[0] == '/');
-        if (path == "/")
-            return path;
-        auto f = path.find_last_of('/');
-        assert(f != string_t::npos);
-        if (f == 0)
-            return "/";
-        return path.substr(0, f);
-    }
-
     time_t cvfs::now() {
         time_t ctime;
         time(&ctime);
@@ -396,39 +520,77 @@ namespace clib {
     }
 
     void cvfs::split_path(const string_t & path, std::vector<string_t> & args, char c) {
-        std::stringstream ss(path);
-        string_t temp;
-        while (std::getline(ss, temp, c)) {
-            args.push_back(temp);
+        size_t start = 0;
+        while (start < path.length()) {
+            auto f = path.find(c, start);
+            if (f == string_t::npos) {
+                args.push_back(path.substr(start));
+                break;
+            }
+            args.push_back(path.substr(start, f - start));
+            start = f + 1;
         }
     }
 
     vfs_node::ref cvfs::get_node(const string_t & path) const {
-        std::vector<string_t> paths;
-        split_path(path, paths, '/');
+        auto f = dentry.find(path);
+        if (f != dentry.end() && f->second.user == current_user) {
+            auto node = f->second.node.lock();
+            if (node)
+                return node;
+        }
+        auto synthetic = false;
+        auto node = lookup(path, synthetic);
+        if (node && node->type != fs_magic && !synthetic) { // magic及虚拟目录下的路径不缓存
+            if (dentry.size() >= VFS_DENTRY_MAX)
+                dentry.clear();
+            dentry[path] = dentry_t{ node, current_user };
+        }
+        return node;
+    }
+
+    vfs_node::ref cvfs::lookup(const string_t & path, bool & synthetic) const {
         auto cur = root;
-        for (size_t i = 0; i < paths.size(); ++i) {
+        if (path.empty())
+            return cur;
+        if (!can_mod(cur, 0))
+            return nullptr;
+        string_t name;
+        auto s = path.c_str();
+        auto end = s + path.length();
+        while (s < end) {
+            if (*s == '/') {
+                s++;
+                continue;
+            }
+            auto e = s;
+            while (e < end && *e != '/')
+                e++;
             if (!can_mod(cur, 0))
                 return nullptr;
-            auto& p = paths[i];
-            if (!p.empty()) {
-                auto f = cur->children.find(p);
-                if (f != cur->children.end()) {
-                    if (f->second->type == fs_magic) {
-                        return f->second;
-                    }
-                    if (i < paths.size() - 1 && f->second->type != fs_dir)
-                        return nullptr;
-                    cur = f->second;
-                }
-                else {
-                    return nullptr;
-                }
-            }
+            expand(cur);
+            if (cur->callback)
+                synthetic = true;
+            name.assign(s, e - s);
+            auto f = cur->children.find(name);
+            if (f == cur->children.end())
+                return nullptr;
+            if (f->second->type == fs_magic)
+                return f->second;
+            s = e;
+            while (s < end && *s == '/')
+                s++;
+            if (s < end && f->second->type != fs_dir)
+                return nullptr;
+            cur = f->second;
         }
         return cur;
     }
 
+    void cvfs::invalidate() {
+        dentry.clear();
+    }
+
     int cvfs::cd(const string_t & path) {
         auto p = combine(pwd, path);
         auto node = get_node(p);
@@ -453,6 +615,7 @@ namespace clib {
         bool update = false;
         for (auto& p : paths) {
             if (!p.empty()) {
+                expand(cur);
                 auto f = cur->children.find(p);
                 if (f != cur->children.end()) {
                     cur = f->second;
@@ -464,6 +627,7 @@ namespace clib {
                         update = true;
                     if (!can_mod(cur, 1))
                         return -3;
+                    invalidate();
                     auto node = new_node(fs_dir);
                     node->parent = cur;
                     node->name = p;
@@ -489,19 +653,31 @@ namespace clib {
         if (path[0] == '/')
             return path;
         auto res = pwd;
-        std::vector<string_t> paths;
-        split_path(path, paths, '/');
-        for (auto& p : paths) {
-            if (!p.empty()) {
-                if (p == ".")
-                    continue;
-                else if (p == "..")
-                    res = get_parent(res);
-                else if (res.back() == '/')
-                    res += p;
-                else
-                    res += "/" + p;
+        res.reserve(pwd.length() + path.length() + 1);
+        auto s = path.c_str();
+        auto end = s + path.length();
+        while (s < end) {
+            if (*s == '/') {
+                s++;
+                continue;
+            }
+            auto e = s;
+            while (e < end && *e != '/')
+                e++;
+            auto len = e - s;
+            if (len == 1 && s[0] == '.') {
             }
+            else if (len == 2 && s[0] == '.' && s[1] == '.') {
+                assert(res[0] == '/');
+                auto f = res.find_last_of('/');
+                res.resize(f == 0 ? 1 : f);
+            }
+            else {
+                if (res.back() != '/')
+                    res += '/';
+                res.append(s, len);
+            }
+            s = e;
         }
         return res;
     }
@@ -574,6 +750,22 @@ namespace clib {
         return -2;
     }
 
+    int cvfs::synth(const string_t & path, vfs_func_t * f) {
+        auto node = get_node(path);
+        if (!node) {
+            vfs_node::ref cur;
+            auto s = _mkdir(path, cur);
+            if (s == 0) { // new dir
+                cur->callback = f;
+                return 0;
+            }
+            else { // exists
+                return 1;
+            }
+        }
+        return -2;
+    }
+
     string_t cvfs::get_filename(const string_t & path) {
         if (path.empty())
             return "";
@@ -590,6 +782,7 @@ namespace clib {
         auto node = get_node(p);
         if (!node)
             return -1;
+        invalidate();
         return node->parent.lock()->children.erase(get_filename(path)) == 0 ?
             -2 : (node->type != fs_dir ? 0 : 1);
     }
@@ -601,6 +794,7 @@ namespace clib {
             return -1;
         if (!can_rm(node))
             return -2;
+        invalidate();
         return node->parent.lock()->children.erase(get_filename(path)) == 0 ?
             -3 : (node->type != fs_dir ? 0 : 1);
     }
@@ -646,4 +840,108 @@ namespace clib {
             write_vfs(path, data);
         }
     }
+
+    int cvfs::mount(const string_t & host, const string_t & path) {
+        auto attr = GetFileAttributesA(host.c_str());
+        if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY))
+            return -1;
+        auto p = combine(pwd, path);
+        auto node = get_node(p);
+        if (!node) {
+            if (_mkdir(p, node) != 0)
+                return -3;
+        }
+        if (node->type != fs_dir)
+            return -2;
+        node->host = std::make_shared<vfs_host>();
+        node->host->path = host;
+        node->host->size = 0;
+        node->host->listed = false;
+        invalidate();
+        ATLTRACE("[SYSTEM] VFS  | Mount: %s -> %s\n", host.c_str(), p.c_str());
+        return 0;
+    }
+
+    static time_t host_time(const FILETIME & ft) {
+        auto t = ((uint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+        return (time_t)((t - 116444736000000000ULL) / 10000000ULL);
+    }
+
+    // 首次访问挂载目录时列出宿主文件，结果缓存在子结点中
+    void cvfs::expand(const vfs_node::ref & node) const {
+        if (node->type == fs_dir && node->callback) { // 虚拟目录
+            auto path = full_path(node);
+            auto v = node->callback->stream_version(path);
+            if (v == node->version)
+                return;
+            node->version = v;
+            std::vector<vfs_entry> list;
+            node->callback->stream_list(path, list);
+            std::map<string_t, vfs_node::ref> children;
+            for (auto& l : list) {
+                auto f = node->children.find(l.first);
+                if (f != node->children.end() && f->second->type == l.second) {
+                    children.insert(*f);
+                    continue;
+                }
+                auto child = new_node(fs_dir);
+                child->type = l.second;
+                child->callback = node->callback;
+                child->owner = node->owner;
+                child->name = l.first;
+                child->parent = node;
+                children.insert(std::make_pair(l.first, child));
+            }
+            node->children = std::move(children);
+            return;
+        }
+        auto& h = node->host;
+        if (!h || node->type != fs_dir || h->listed)
+            return;
+        h->listed = true;
+        WIN32_FIND_DATAA fd;
+        auto find = FindFirstFileA((h->path + "/*").c_str(), &fd);
+        if (find == INVALID_HANDLE_VALUE)
+            return;
+        do {
+            string_t name(fd.cFileName);
+            if (name == "." || name == "..")
+                continue;
+            if (node->children.find(name) != node->children.end())
+                continue;
+            auto dir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            auto child = new_node(dir ? fs_dir : fs_file);
+            if (!dir)
+                mod_copy(child->mod, "r--r--r--");
+            child->owner = node->owner;
+            child->time.create = host_time(fd.ftCreationTime);
+            child->time.access = host_time(fd.ftLastAccessTime);
+            child->time.modify = host_time(fd.ftLastWriteTime);
+            child->name = name;
+            child->parent = node;
+            child->host = std::make_shared<vfs_host>();
+            child->host->path = h->path + "/" + name;
+            child->host->size = dir ? 0 : (size_t)(((uint64)fd.nFileSizeHigh << 32) | fd.nFileSizeLow);
+            child->host->listed = false;
+            node->children.insert(std::make_pair(name, child));
+        } while (FindNextFileA(find, &fd));
+        FindClose(find);
+    }
+
+    std::shared_ptr<vfs_mapping> cvfs::map(const vfs_node::ref & node) const {
+        auto m = node->host->mapping.lock();
+        if (m)
+            return m;
+        m = std::make_shared<vfs_mapping>(node->host->path);
+        if (!m->valid())
+            return nullptr;
+        node->host->mapping = m;
+        return m;
+    }
+
+    size_t cvfs::file_size(const vfs_node::ref & node) {
+        if (node->host && node->type == fs_file)
+            return node->host->size;
+        return node->data.size();
+    }
 }
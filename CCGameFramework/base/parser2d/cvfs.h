@@ -8,12 +8,15 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <memory>
 #include "memory.h"
 
 #define FILE_ROOT "./script/code"
 #define WAIT_CHAR 0x10000
 #define READ_EOF 0x2000
+#define VFS_DENTRY_MAX 4096
+#define VFS_CHUNK_SIZE 4096
 
 namespace clib {
 
@@ -36,13 +39,70 @@ namespace clib {
         fss_net,
     };
 
+    // 文件内容，按定长块存储
+    // 拷贝时共享块（快照），写入共享的尾块前先复制
+    class vfs_data {
+    public:
+        struct chunk_t {
+            byte data[VFS_CHUNK_SIZE];
+        };
+        using chunk = std::shared_ptr<chunk_t>;
+
+        size_t size() const;
+        bool empty() const;
+        byte operator[](size_t idx) const;
+        void push_back(byte c);
+        void append(const byte* buf, size_t len);
+        size_t read(size_t off, byte* buf, size_t len) const;
+        void clear();
+
+    private:
+        byte* tail();
+
+        std::vector<chunk> chunks;
+        size_t length{ 0 };
+    };
+
+    // 宿主文件的只读映射
+    class vfs_mapping {
+    public:
+        explicit vfs_mapping(const string_t& file);
+        ~vfs_mapping();
+        vfs_mapping(const vfs_mapping&) = delete;
+        vfs_mapping& operator=(const vfs_mapping&) = delete;
+
+        bool valid() const;
+        const byte* data() const;
+        size_t size() const;
+
+    private:
+        const byte* view{ nullptr };
+        size_t length{ 0 };
+        bool ok{ false };
+    };
+
+    // 挂载的宿主目录或文件
+    struct vfs_host {
+        string_t path;
+        size_t size;
+        bool listed; // 目录已展开
+        std::weak_ptr<vfs_mapping> mapping; // 打开时建立，句柄全关闭后释放
+    };
+
+    // 打开时生成的内容快照，内容未变时多次打开共享同一份
+    using vfs_snapshot = std::shared_ptr<const string_t>;
+    using vfs_entry = std::pair<string_t, vfs_file_t>;
+
     class vfs_node_dec;
     class vfs_mod_query;
     class vfs_func_t {
     public:
-        virtual string_t stream_callback(const string_t& path) = 0;
+        virtual vfs_snapshot stream_callback(const string_t& path) = 0;
         virtual vfs_stream_t stream_type(const string_t& path) const = 0;
         virtual vfs_node_dec* stream_create(const vfs_mod_query* mod, vfs_stream_t type, const string_t& path) = 0;
+        // 虚拟目录：查找时才生成子结点，版本变化后重建
+        virtual int stream_version(const string_t& path) = 0;
+        virtual void stream_list(const string_t& path, std::vector<vfs_entry>& list) = 0;
     };
 
     // 结点
@@ -61,8 +121,10 @@ namespace clib {
         bool locked;
         string_t name;
         std::map<string_t, ref> children;
-        std::vector<byte> data;
+        vfs_data data;
         vfs_func_t* callback;
+        std::shared_ptr<vfs_host> host;
+        int version; // 虚拟目录已生成的版本
         weak_ref parent;
     };
 
@@ -110,13 +172,26 @@ namespace clib {
         int index() const override;
     private:
         explicit vfs_node_cached(const vfs_mod_query*, const string_t& str);
-        string_t cache;
+        explicit vfs_node_cached(const vfs_mod_query*, const vfs_snapshot& snapshot);
+        vfs_snapshot cache;
+    };
+
+    class vfs_node_mapped : public vfs_node_dec {
+        friend class cvfs;
+    public:
+        bool available() const override;
+        int index() const override;
+    private:
+        explicit vfs_node_mapped(const vfs_mod_query*, const std::shared_ptr<vfs_mapping>& map);
+        std::shared_ptr<vfs_mapping> mapping;
     };
 
     class vfs_stream_call {
     public:
         virtual int stream_index(vfs_stream_t type) = 0;
         virtual string_t stream_net(vfs_stream_t type, const string_t& path) = 0;
+        // 流数据到达，唤醒poll中等待该句柄的进程
+        virtual void stream_ready(vfs_node_dec* dec) = 0;
     };
 
     class vfs_node_stream : public vfs_node_dec {
@@ -151,28 +226,35 @@ namespace clib {
         int touch(const string_t& path);
         int func(const string_t& path, vfs_func_t* f);
         int magic(const string_t& path, vfs_func_t* f);
+        int synth(const string_t& path, vfs_func_t* f);
         int rm(const string_t& path);
         int rm_safe(const string_t& path);
         void load(const string_t& path);
+        int mount(const string_t& host, const string_t& path);
 
         static void split_path(const string_t& path, std::vector<string_t>& args, char c);
         static string_t get_filename(const string_t& path);
 
     private:
-        vfs_node::ref new_node(vfs_file_t type);
+        vfs_node::ref new_node(vfs_file_t type) const;
         vfs_node::ref get_node(const string_t& path) const;
         int _mkdir(const string_t& path, vfs_node::ref& cur);
         void _touch(vfs_node::ref& node);
+        vfs_node::ref lookup(const string_t& path, bool& synthetic) const;
+        void invalidate();
+        void expand(const vfs_node::ref& node) const;
+        std::shared_ptr<vfs_mapping> map(const vfs_node::ref& node) const;
+        static size_t file_size(const vfs_node::ref& node);
 
         string_t combine(const string_t& pwd, const string_t& path) const;
         int macro(const std::vector<string_t>& m, const vfs_node::ref& node, vfs_node_dec** dec) const;
         void ll(const string_t& name, const vfs_node::ref& node, std::ostream& os) const;
 
-        void error(const string_t&);
+        void error(const string_t&) const;
 
         static time_t now();
 
-        char* file_time(const time_t& t) const;
+        string_t file_time(const time_t& t) const;
         bool can_rm(const vfs_node::ref& node) const;
 
     public:
@@ -185,6 +267,12 @@ namespace clib {
         int last_user{ 0 };
         string_t pwd;
         int year{ 0 };
+        // 目录项缓存：绝对路径 -> 结点，按用户区分权限
+        struct dentry_t {
+            vfs_node::weak_ref node;
+            int user;
+        };
+        mutable std::unordered_map<string_t, dentry_t> dentry;
     };
 }
 
@@ -7,12 +7,13 @@
 #include <cassert>
 #include <memory.h>
 #include <cstring>
+#include <cstddef>
 #include <regex>
 #include <random>
+#include <algorithm>
 #include "cvm.h"
 #include "cgen.h"
 #include "cexception.h"
-#include "cgui.h"
 #include "cnet.h"
 
 #define LOG_INS 0
@@ -26,10 +27,14 @@ namespace clib {
 
 #define INC_PTR 4
 
-    cvm::global_state_t cvm::global_state;
+    thread_local cvm::context_t* cvm::ctx = nullptr;
 
     uint32_t cvm::pmm_alloc(bool reusable) {
-        auto ptr = (uint32_t)memory.alloc_array<byte>(PAGE_SIZE * 2);
+        uint32_t ptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx_mem);
+            ptr = (uint32_t)memory.alloc_array<byte>(PAGE_SIZE * 2);
+        }
         if (!ptr)
             error("alloc page failed");
         if (reusable)
@@ -73,16 +78,22 @@ namespace clib {
 
     void cvm::init_fs() {
         fs.as_root(true);
-        fs.mkdir("/sys");
-        fs.func("/sys/ps", this);
-        fs.mkdir("/proc");
+        fs.synth("/sys", this);
+        fs.synth("/proc", this);
         fs.mkdir("/dev");
         fs.func("/dev/random", this);
         fs.func("/dev/null", this);
         fs.magic("/http", this);
         fs.as_root(false);
+#if VM_MOUNT_USR
+        if (fs.mount(FILE_ROOT "/usr", "/usr") != 0) {
+            fs.load("/usr/logo.txt");
+            fs.load("/usr/badapple.txt");
+        }
+#else
         fs.load("/usr/logo.txt");
         fs.load("/usr/badapple.txt");
+#endif
     }
 
     // 虚页映射
@@ -265,16 +276,110 @@ namespace clib {
 
     //-----------------------------------------
 
-    cvm::cvm() {
+    cvm::cvm(vm_host_t* host) : host(host),
+        random_engine(((uint32_t)time(nullptr)) % (UINT32_MAX)) {
         vmm_init();
     }
 
     cvm::~cvm() {
+        smp_stop();
+        if (ctx >= tasks.data() && ctx < tasks.data() + TASK_NUM)
+            ctx = nullptr;
         free(pgd_kern);
         free(pte_kern);
     }
 
-    bool cvm::run(int cycle, int& cycles) {
+    void cvm::set_smp(int workers) {
+        smp_stop();
+        workers = min(workers, SMP_MAX_WORKERS);
+        if (workers <= 1)
+            return;
+        smp_exit = false;
+        smp_round = 0;
+        for (auto i = 0; i < workers; ++i) {
+            smp_queues.push_back(std::make_unique<run_queue_t>());
+        }
+        for (auto i = 0; i < workers; ++i) {
+            smp_workers.emplace_back(&cvm::smp_worker, this, i);
+        }
+#if LOG_SYSTEM
+        ATLTRACE("[SYSTEM] SMP  | Workers: %d\n", workers);
+#endif
+    }
+
+    void cvm::smp_stop() {
+        if (smp_workers.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(smp_lock);
+            smp_exit = true;
+        }
+        smp_start.notify_all();
+        for (auto& th : smp_workers) {
+            th.join();
+        }
+        smp_workers.clear();
+        smp_queues.clear();
+    }
+
+    cvm::context_t* cvm::smp_next(int id) {
+        auto n = (int)smp_queues.size();
+        {
+            auto& q = *smp_queues[id];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (!q.queue.empty()) {
+                auto c = q.queue.front();
+                q.queue.pop_front();
+                return c;
+            }
+        }
+        for (auto i = 1; i < n; ++i) {
+            auto& q = *smp_queues[(id + i) % n];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (!q.queue.empty()) {
+                auto c = q.queue.back();
+                q.queue.pop_back();
+                return c;
+            }
+        }
+        return nullptr;
+    }
+
+    void cvm::smp_worker(int id) {
+        auto round = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(smp_lock);
+                smp_start.wait(lock, [&]() { return smp_exit || smp_round != round; });
+                if (smp_exit)
+                    return;
+                round = smp_round;
+            }
+            auto cycles = 0;
+            context_t* c;
+            while (!smp_failed && (c = smp_next(id)) != nullptr) {
+                ctx = c;
+                try {
+                    exec(smp_cycle, cycles);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(smp_lock);
+                    if (!smp_error)
+                        smp_error = std::current_exception();
+                    smp_failed = true;
+                }
+            }
+            ctx = nullptr;
+            smp_cycles += cycles;
+            {
+                std::lock_guard<std::mutex> lock(smp_lock);
+                if (--smp_pending == 0)
+                    smp_done.notify_one();
+            }
+        }
+    }
+
+    void cvm::run_serial(int cycle, int& cycles) {
         for (int i = 0; i < TASK_NUM; ++i) {
             if (tasks[i].flag & CTX_VALID) {
                 if (tasks[i].state == CTS_RUNNING) {
@@ -283,6 +388,61 @@ namespace clib {
                 }
             }
         }
+    }
+
+    void cvm::run_smp(int cycle, int& cycles) {
+        auto n = (int)smp_queues.size();
+        auto k = 0;
+        for (int i = 0; i < TASK_NUM; ++i) {
+            smp_scheduled[i] = (tasks[i].flag & CTX_VALID) && tasks[i].state == CTS_RUNNING;
+            if (smp_scheduled[i]) {
+                smp_queues[k]->queue.push_back(&tasks[i]);
+                k = (k + 1) % n;
+            }
+        }
+        if (k == 0 && smp_queues[0]->queue.empty())
+            return;
+        smp_cycle = cycle;
+        smp_cycles = 0;
+        smp_active = true;
+        {
+            std::lock_guard<std::mutex> lock(smp_lock);
+            smp_pending = n;
+            smp_round++;
+        }
+        smp_start.notify_all();
+        {
+            std::unique_lock<std::mutex> lock(smp_lock);
+            smp_done.wait(lock, [&]() { return smp_pending == 0; });
+        }
+        smp_active = false;
+        cycles += smp_cycles;
+        for (auto& q : smp_queues) {
+            q->queue.clear();
+        }
+        // 本轮中被其他CPU结束的进程，统一在此销毁
+        auto kill = std::move(smp_kill);
+        smp_kill.clear();
+        for (auto& id : kill) {
+            if (tasks[id].flag & CTX_VALID)
+                destroy(id);
+        }
+        if (smp_error) {
+            auto e = smp_error;
+            smp_error = nullptr;
+            smp_failed = false;
+            std::rethrow_exception(e);
+        }
+    }
+
+    bool cvm::run(int cycle, int& cycles) {
+        ctx_scope scope;
+        ctx = nullptr;
+        poll_wakeup();
+        if (smp_workers.empty())
+            run_serial(cycle, cycles);
+        else
+            run_smp(cycle, cycles);
         if (global_state.interrupt) {
             global_state.interrupt = false;
             std::vector<int> foreground_pids;
@@ -298,7 +458,6 @@ namespace clib {
                 destroy(pid);
             }
         }
-        ctx = nullptr;
         return available_tasks > 0;
     }
 
@@ -309,15 +468,22 @@ namespace clib {
             i++;
             cycles++;
             if (global_state.interrupt) break;
-            if ((ctx->pc & 0xF0000000) != USER_BASE) {
-                if (ctx->pc != 0xE0000FF4 && ctx->pc != 0xE0000FFC) {
+            int op;
+            auto idx = (ctx->pc - ctx->base) / INC_PTR;
+            if (idx < ctx->code_len) {
+                op = ctx->code[idx]; // 代码段已在载入时校验，直接取指
+            }
+            else {
+                if ((ctx->pc & 0xF0000000) != USER_BASE) {
+                    if (ctx->pc != 0xE0000FF4 && ctx->pc != 0xE0000FFC) {
 #if LOG_SYSTEM
-                    ATLTRACE("[SYSTEM] ERR  | Invalid PC: %p\n", (void*)ctx->pc);
+                        ATLTRACE("[SYSTEM] ERR  | Invalid PC: %p\n", (void*)ctx->pc);
 #endif
-                    error("only code segment can execute");
+                        error("only code segment can execute");
+                    }
                 }
+                op = vmm_get(ctx->pc); // get next operation code
             }
-            auto op = vmm_get(ctx->pc); // get next operation code
             ctx->pc += INC_PTR;
 
 #if LOG_INS
@@ -326,12 +492,12 @@ namespace clib {
             if (ctx->debug) {
                 ATLTRACE("%04d> [%08X] %02d %.4s", i, ctx->pc, op, INS_STRING((ins_t)op).c_str());
                 if ((op >= PUSH && op <= LNT) || op == LOAD || op == SAVE)
-                    ATLTRACE(" %d\n", vmm_get(ctx->pc));
+                    ATLTRACE(" %d\n", fetch());
                 else if (op == IMX)
-                    ATLTRACE(" %08X(%d) %08X(%d)\n", vmm_get(ctx->pc), vmm_get(ctx->pc),
+                    ATLTRACE(" %08X(%d) %08X(%d)\n", fetch(), fetch(),
                         vmm_get(ctx->pc + INC_PTR), vmm_get(ctx->pc + INC_PTR));
                 else if (op <= ADJ)
-                    ATLTRACE(" %08X(%d)\n", vmm_get(ctx->pc), vmm_get(ctx->pc));
+                    ATLTRACE(" %08X(%d)\n", fetch(), fetch());
                 else
                     ATLTRACE("\n");
             }
@@ -340,19 +506,19 @@ namespace clib {
             case NOP:
                 break;
             case IMM: {
-                ctx->ax._i = vmm_get(ctx->pc);
+                ctx->ax._i = fetch();
                 ctx->pc += INC_PTR;
             } /* load immediate value to ctx->ax._i */
                       break;
             case IMX: {
-                ctx->ax._u._1 = vmm_get(ctx->pc);
+                ctx->ax._u._1 = fetch();
                 ctx->pc += INC_PTR;
-                ctx->ax._u._2 = vmm_get(ctx->pc);
+                ctx->ax._u._2 = fetch();
                 ctx->pc += INC_PTR;
             } /* load immediate value to ctx->ax._i */
                       break;
             case LOAD: {
-                auto n = vmm_get(ctx->pc);
+                auto n = fetch();
                 if (n <= 8) {
                     switch (n) {
                     case 1:
@@ -388,7 +554,7 @@ namespace clib {
             } /* load integer to ctx->ax._i, address in ctx->ax._i */
                        break;
             case SAVE: {
-                auto n = vmm_get(ctx->pc);
+                auto n = fetch();
                 if (n <= 8) {
                     switch (n) {
                     case 1:
@@ -424,7 +590,7 @@ namespace clib {
             } /* save integer to address, value in ctx->ax._i, address on stack */
                        break;
             case PUSH: {
-                auto n = vmm_get(ctx->pc);
+                auto n = fetch();
                 if (n <= 8) {
                     switch (n) {
                     case 4:
@@ -455,7 +621,7 @@ namespace clib {
             } /* push the value of ctx->ax._i onto the stack */
                        break;
             case POP: {
-                auto n = vmm_get(ctx->pc);
+                auto n = fetch();
                 if (n <= 8) {
                     switch (n) {
                     case 4:
@@ -485,17 +651,55 @@ namespace clib {
             } /* pop the value of ctx->ax._i from the stack */
                       break;
             case JMP: {
-                ctx->pc = ctx->base + vmm_get(ctx->pc) * INC_PTR;
+                ctx->pc = ctx->base + fetch() * INC_PTR;
             } /* jump to the address */
                       break;
             case JZ: {
-                ctx->pc = ctx->ax._i ? ctx->pc + INC_PTR : (ctx->base + vmm_get(ctx->pc) * INC_PTR);
+                ctx->pc = ctx->ax._i ? ctx->pc + INC_PTR : (ctx->base + fetch() * INC_PTR);
             } /* jump if ctx->ax._i is zero */
                      break;
             case JNZ: {
-                ctx->pc = ctx->ax._i ? (ctx->base + vmm_get(ctx->pc) * INC_PTR) : ctx->pc + INC_PTR;
+                ctx->pc = ctx->ax._i ? (ctx->base + fetch() * INC_PTR) : ctx->pc + INC_PTR;
             } /* jump if ctx->ax._i is zero */
                       break;
+            case JTAB: {
+                auto table = (uint32_t)fetch();
+                auto idx = (uint32_t)ctx->ax._i - (uint32_t)vmm_get(table);
+                if (idx < (uint32_t)vmm_get(table + INC_PTR))
+                    ctx->pc = ctx->base + vmm_get(table + (3 + idx) * INC_PTR) * INC_PTR;
+                else
+                    ctx->pc = ctx->base + vmm_get(table + 2 * INC_PTR) * INC_PTR;
+            } /* jump by table[ctx->ax._i - low], table: [low, count, default, addr...] */
+                       break;
+            case JMAP: {
+                auto table = (uint32_t)fetch();
+                auto target = vmm_get(table + INC_PTR);
+                int left = 0, right = vmm_get(table) - 1;
+                while (left <= right) {
+                    auto mid = (left + right) / 2;
+                    auto key = vmm_get(table + (2 + mid * 2) * INC_PTR);
+                    if (key == ctx->ax._i) {
+                        target = vmm_get(table + (3 + mid * 2) * INC_PTR);
+                        break;
+                    }
+                    if (key < ctx->ax._i)
+                        left = mid + 1;
+                    else
+                        right = mid - 1;
+                }
+                ctx->pc = ctx->base + target * INC_PTR;
+            } /* binary search sorted table: [count, default, (key, addr)...] */
+                       break;
+            case TAIL: {
+                auto n = fetch();
+                for (auto j = 0; j < n; ++j) {
+                    vmm_set(ctx->bp + 2 * INC_PTR + j * INC_PTR, vmm_get(ctx->sp + j * INC_PTR));
+                }
+                ctx->sp = ctx->bp;
+                ctx->bp = (uint32_t)vmm_popstack(ctx->sp);
+                ctx->pc = ctx->base + (ctx->ax._ui) * INC_PTR;
+            } /* tail call: move arguments into current frame, drop it, jump */
+                       break;
             case CALL: {
                 vmm_pushstack(ctx->sp, ctx->pc);
                 ctx->pc = ctx->base + (ctx->ax._ui) * INC_PTR;
@@ -505,12 +709,12 @@ namespace clib {
             case ENT: {
                 vmm_pushstack(ctx->sp, ctx->bp);
                 ctx->bp = ctx->sp;
-                ctx->sp = ctx->sp - vmm_get(ctx->pc);
+                ctx->sp = ctx->sp - fetch();
                 ctx->pc += INC_PTR;
             } /* make new stack frame */
                       break;
             case ADJ: {
-                ctx->sp = ctx->sp + vmm_get(ctx->pc) * INC_PTR;
+                ctx->sp = ctx->sp + fetch() * INC_PTR;
                 ctx->pc += INC_PTR;
             } /* add esp, <size> */
                       break;
@@ -520,8 +724,12 @@ namespace clib {
                 ctx->pc = (uint32_t)vmm_popstack(ctx->sp);
             } /* restore call frame and PC */
                       break;
+            case RET: {
+                ctx->pc = (uint32_t)vmm_popstack(ctx->sp);
+            } /* return from frameless function */
+                      break;
             case LEA: {
-                ctx->ax._i = ctx->bp + vmm_get(ctx->pc);
+                ctx->ax._i = ctx->bp + fetch();
                 ctx->pc += INC_PTR;
             } /* load address for arguments. */
                       break;
@@ -536,7 +744,7 @@ namespace clib {
                 break;
                 // OPERATOR
             case OR:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -560,7 +768,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case XOR:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -584,7 +792,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case AND:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -608,7 +816,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case EQ:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -639,7 +847,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case NE:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -670,7 +878,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case LT:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -701,7 +909,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case LE:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -732,7 +940,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case GT:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -763,7 +971,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case GE:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -794,7 +1002,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case SHL:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -818,7 +1026,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case SHR:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -842,7 +1050,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case ADD:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -875,7 +1083,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case SUB:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -908,7 +1116,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case MUL:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -938,7 +1146,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case DIV:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -980,7 +1188,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case MOD:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -1004,7 +1212,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case NEG:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -1026,7 +1234,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case NOT:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -1050,7 +1258,7 @@ namespace clib {
                 ctx->pc += INC_PTR;
                 break;
             case LNT:
-                switch ((cast_t)vmm_get(ctx->pc)) {
+                switch ((cast_t)fetch()) {
                 case t_char:
                 case t_short:
                 case t_int:
@@ -1132,15 +1340,145 @@ namespace clib {
         throw cexception(ex_vm, str);
     }
 
+    // 载入时校验：PE结构错误直接报错；指令流校验失败则退回逐条检查的取指方式
+    bool cvm::verify(const std::vector<byte> & file) const {
+        if (file.size() < offsetof(PE, data))
+            error("invalid PE file: header");
+        auto pe = (const PE*)file.data();
+        if (std::memcmp(pe->magic, PE_MAGIC, sizeof(pe->magic)) != 0)
+            error("invalid PE file: magic");
+        if ((uint64)offsetof(PE, data) + pe->data_len + pe->text_len != file.size())
+            error("invalid PE file: size");
+        if (pe->text_len % sizeof(int) != 0)
+            error("invalid PE file: text");
+        auto text = (const int*)(&pe->data + pe->data_len);
+        auto len = (int)(pe->text_len / sizeof(int));
+        if (pe->entry >= (uint)len)
+            error("invalid PE file: entry");
+        auto fail = [](int i, const char* msg) {
+#if LOG_SYSTEM
+            ATLTRACE("[SYSTEM] ERR  | Verify: [%04d] %s\n", i, msg);
+#endif
+            return false;
+        };
+        // 第一遍：划分指令边界
+        std::vector<bool> start((size_t)len, false);
+        auto i = 0;
+        while (i < len) {
+            auto op = text[i];
+            if (op < NOP || op > EXIT)
+                return fail(i, "invalid opcode");
+            start[i] = true;
+            i += INS_SIZE((ins_t)op);
+        }
+        if (i != len)
+            return fail(len, "truncated instruction");
+        if (!start[pe->entry])
+            return fail(pe->entry, "invalid entry");
+        auto target = [&](int t) {
+            return t >= 0 && t < len && start[t];
+        };
+        auto table = [&](int addr, int n) -> const int* {
+            auto off = (uint)addr & 0x0FFFFFFF;
+            if (((uint)addr & 0xF0000000) != DATA_BASE || off % sizeof(int) != 0 || n < 0)
+                return nullptr;
+            if ((uint64)off + (uint64)n * sizeof(int) > pe->data_len)
+                return nullptr;
+            return (const int*)(&pe->data + off);
+        };
+        // 第二遍：校验操作数
+        for (i = 0; i < len; ++i) {
+            if (!start[i])
+                continue;
+            auto op = text[i];
+            auto n = INS_SIZE((ins_t)op) > 1 ? text[i + 1] : 0;
+            switch (op) {
+            case JMP:
+            case JZ:
+            case JNZ:
+                if (!target(n))
+                    return fail(i, "invalid jump target");
+                break;
+            case JTAB: {
+                auto t = table(n, 3);
+                if (!t || t[1] < 0 || !(t = table(n, 3 + t[1])))
+                    return fail(i, "invalid jump table");
+                if (!target(t[2]))
+                    return fail(i, "invalid jump table target");
+                for (auto j = 0; j < t[1]; ++j) {
+                    if (!target(t[3 + j]))
+                        return fail(i, "invalid jump table target");
+                }
+            }
+                       break;
+            case JMAP: {
+                auto t = table(n, 2);
+                if (!t || t[0] < 0 || !(t = table(n, 2 + t[0] * 2)))
+                    return fail(i, "invalid jump map");
+                if (!target(t[1]))
+                    return fail(i, "invalid jump map target");
+                for (auto j = 0; j < t[0]; ++j) {
+                    if (!target(t[3 + j * 2]))
+                        return fail(i, "invalid jump map target");
+                    if (j > 0 && t[2 + j * 2] <= t[j * 2])
+                        return fail(i, "unsorted jump map");
+                }
+            }
+                       break;
+            case LOAD:
+            case SAVE:
+                if (n <= 0 || n > BIG_DATA_NUM || (n > 4 && n < 8))
+                    return fail(i, "invalid load/save size");
+                break;
+            case PUSH:
+            case POP:
+                if (!(n == 4 || n == 8 || (n > 8 && n <= BIG_DATA_NUM)))
+                    return fail(i, "invalid push/pop size");
+                break;
+            case ENT:
+                if (n < 0 || n > PAGE_SIZE)
+                    return fail(i, "invalid frame size");
+                break;
+            case ADJ:
+            case TAIL:
+                if (n < 0 || n > PAGE_SIZE / INC_PTR)
+                    return fail(i, "invalid stack adjust");
+                break;
+            case CAST:
+                if (n < 1 || n > CAST_OP_MAX)
+                    return fail(i, "invalid cast");
+                break;
+            default:
+                if (op >= OR && op <= LNT && op != CASE && (n < t_char || n >= t_error))
+                    return fail(i, "invalid operand type");
+                break;
+            }
+        }
+        return true;
+    }
+
+    // 读取当前指令的操作数，已校验的代码段直接读取
+    int cvm::fetch() const {
+        auto idx = (ctx->pc - ctx->base) / INC_PTR;
+        if (idx < ctx->code_len)
+            return ctx->code[idx];
+        return vmm_get(ctx->pc);
+    }
+
     int cvm::load(const string_t & path, const std::vector<byte> & file, const std::vector<string_t> & args) {
-        auto old_ctx = ctx;
+        std::lock_guard<std::recursive_mutex> lock_fs(mtx_fs), lock_task(mtx_task);
+        auto trusted = verify(file);
+        ctx_scope scope;
         new_pid();
         ctx->file = file;
 #if LOG_SYSTEM
-        ATLTRACE("[SYSTEM] PROC | Create: PID= #%d\n", ctx->id);
+        ATLTRACE("[SYSTEM] PROC | Create: PID= #%d, Verified= %d\n", ctx->id, trusted ? 1 : 0);
 #endif
-        PE* pe = (PE*)file.data();
-        // TODO: VALID PE FILE
+        PE* pe = (PE*)ctx->file.data();
+        if (trusted) {
+            ctx->code = (const int*)(&pe->data + pe->data_len);
+            ctx->code_len = pe->text_len / sizeof(int);
+        }
         uint32_t pa;
         ctx->poolsize = PAGE_SIZE;
         ctx->mask = U2K(ctx->id);
@@ -1228,18 +1566,25 @@ namespace clib {
         ctx->flag |= CTX_USER_MODE | CTX_FOREGROUND;
         ctx->debug = false;
         ctx->waiting_ms = 0;
+        ctx->poll_wait = false;
+        ctx->poll_lock = false;
+        ctx->poll.clear();
         ctx->input_redirect = -1;
         ctx->output_redirect = -1;
         ctx->input_queue.clear();
         ctx->input_stop = false;
         available_tasks++;
-        auto pid = ctx->id;
-        ctx = old_ctx;
-        return pid;
+        return ctx->id;
     }
 
     void cvm::destroy(int id) {
-        auto old_ctx = ctx;
+        std::lock_guard<std::recursive_mutex> lock_fs(mtx_fs), lock_task(mtx_task);
+        if (smp_active && smp_scheduled[id] && (!ctx || ctx->id != id)) {
+            // 该进程可能正在其他CPU上运行，推迟到本轮结束
+            smp_kill.push_back(id);
+            return;
+        }
+        ctx_scope scope;
         ctx = &tasks[id];
         {
             if (global_state.input_lock == ctx->id) {
@@ -1247,14 +1592,14 @@ namespace clib {
                 global_state.input_read_ptr = -1;
                 global_state.input_content.clear();
                 global_state.input_success = false;
-                cgui::singleton().reset_cmd();
+                host->reset_cmd();
             }
             if (set_cycle_id == ctx->id) {
-                cgui::singleton().set_cycle(0);
+                host->set_cycle(0);
                 set_cycle_id = -1;
             }
             if (set_resize_id == ctx->id) {
-                cgui::singleton().resize(0, 0);
+                host->resize(0, 0);
                 set_resize_id = -1;
             }
             if (ctx->output_redirect != -1 && tasks[ctx->output_redirect].flag & CTX_VALID) {
@@ -1269,7 +1614,6 @@ namespace clib {
         }
         if (!ctx->child.empty()) {
             ctx->state = CTS_ZOMBIE;
-            ctx = old_ctx;
             return;
         }
 #if LOG_SYSTEM
@@ -1311,12 +1655,15 @@ namespace clib {
                 }
             }
             {
+                std::lock_guard<std::mutex> lock(mtx_mem);
                 for (auto& a : ctx->allocation) {
                     memory.free_array((byte*)a);
                 }
             }
             ctx->child.clear();
             ctx->state = CTS_DEAD;
+            ctx->code = nullptr;
+            ctx->code_len = 0;
             ctx->file.clear();
             ctx->allocation.clear();
             ctx->pool.reset();
@@ -1339,13 +1686,8 @@ namespace clib {
             ctx->text_mem.clear();
             ctx->stack_mem.clear();
             ctx->input_queue.clear();
-            {
-                std::stringstream ss;
-                ss << "/proc/" << ctx->id;
-                fs.rm(ss.str());
-            }
+            proc_version++;
         }
-        ctx = old_ctx;
         available_tasks--;
     }
 
@@ -1373,12 +1715,14 @@ namespace clib {
         if (path.empty())
             return -1;
         auto new_path = trim(path);
+        std::vector<string_t> args;
+        auto file = get_args(new_path, args);
+        auto pid = host->compile(file, args);
+        if (pid == VM_COMPILE_PENDING)
+            return pid;
 #if LOG_SYSTEM
         ATLTRACE("[SYSTEM] PROC | Exec: Command= %s\n", new_path.data());
 #endif
-        std::vector<string_t> args;
-        auto file = get_args(new_path, args);
-        auto pid = cgui::singleton().compile(file, args);
         if (pid >= 0) { // SUCCESS
             ctx->child.insert(pid);
             tasks[pid].parent = ctx->id;
@@ -1397,7 +1741,10 @@ namespace clib {
         ATLTRACE("[SYSTEM] PROC | Fork: Parent= #%d, Child= #%d\n", old_ctx->id, ctx->id);
 #endif
         PE* pe = (PE*)ctx->file.data();
-        // TODO: VALID PE FILE
+        if (old_ctx->code) {
+            ctx->code = (const int*)(&pe->data + pe->data_len);
+            ctx->code_len = old_ctx->code_len;
+        }
         uint32_t pa;
         ctx->poolsize = PAGE_SIZE;
         ctx->mask = ((uint)(ctx->id << 16) & 0x00ff0000);
@@ -1472,6 +1819,9 @@ namespace clib {
         ctx->bp = old_ctx->bp;
         ctx->debug = old_ctx->debug;
         ctx->waiting_ms = 0;
+        ctx->poll_wait = false;
+        ctx->poll_lock = false;
+        ctx->poll.clear();
         ctx->input_redirect = old_ctx->input_redirect;
         ctx->output_redirect = old_ctx->output_redirect;
         ctx->input_stop = old_ctx->input_stop;
@@ -1537,8 +1887,54 @@ namespace clib {
         }
     }
 
-    string_t cvm::stream_callback(const string_t & path) {
-        static char sz[256];
+    vfs_snapshot cvm::stream_callback(const string_t & path) {
+        std::lock_guard<std::recursive_mutex> lock(mtx_task);
+        if (path == "/sys/ps") {
+            // 逐项比较输出用到的字段，进程表未变化时复用上次生成的快照
+            ps_key_t key;
+            for (auto i = 0; i < TASK_NUM; ++i) {
+                if (tasks[i].flag & CTX_VALID)
+                    key.emplace_back(i, (int)tasks[i].state, tasks[i].parent, tasks[i].path);
+            }
+            auto alloc = ctx->allocation.size();
+            if (!ps_snapshot || alloc != ps_alloc || key != ps_key) {
+                ps_key = std::move(key);
+                ps_alloc = alloc;
+                ps_snapshot = std::make_shared<const string_t>(stream_text(path));
+            }
+            return ps_snapshot;
+        }
+        return std::make_shared<const string_t>(stream_text(path));
+    }
+
+    int cvm::stream_version(const string_t & path) {
+        std::lock_guard<std::recursive_mutex> lock(mtx_task);
+        if (path == "/proc")
+            return proc_version;
+        return 0;
+    }
+
+    void cvm::stream_list(const string_t & path, std::vector<vfs_entry> & list) {
+        std::lock_guard<std::recursive_mutex> lock(mtx_task);
+        if (path == "/proc") {
+            for (auto i = 0; i < TASK_NUM; ++i) {
+                if (tasks[i].flag & CTX_VALID)
+                    list.push_back(std::make_pair(std::to_string(i), fs_dir));
+            }
+        }
+        else if (path.substr(0, 6) == "/proc/") { // '/proc/[pid]'
+            list.push_back(std::make_pair("exe", fs_func));
+            list.push_back(std::make_pair("parent", fs_func));
+            list.push_back(std::make_pair("heap_size", fs_func));
+        }
+        else if (path == "/sys") {
+            list.push_back(std::make_pair("ps", fs_func));
+            list.push_back(std::make_pair("compiler", fs_func));
+        }
+    }
+
+    string_t cvm::stream_text(const string_t & path) {
+        char sz[256];
         if (path.substr(0, 5) == "/proc") {
             static string_t pat{ R"(/proc/(\d+)/([a-z_]+))" };
             static std::regex re(pat);
@@ -1584,6 +1980,9 @@ namespace clib {
                     }
                     return ss.str();
                 }
+                else if (op == "compiler") {
+                    return host->compile_report();
+                }
             }
         }
         else if (path.substr(0, 5) == "/http") {
@@ -1606,9 +2005,8 @@ namespace clib {
     int cvm::stream_index(vfs_stream_t type) {
         switch (type) {
         case fss_random: {
-            static std::default_random_engine e(((uint32_t)time(nullptr)) % (UINT32_MAX));
-            static std::uniform_int_distribution<int> u(0, 255);
-            return u(e);
+            std::uniform_int_distribution<int> u(0, 255);
+            return u(random_engine);
         }
         case fss_null: {
             return 0;
@@ -1632,6 +2030,84 @@ namespace clib {
         return "";
     }
 
+    void cvm::stream_ready(vfs_node_dec * dec) {
+        std::lock_guard<std::recursive_mutex> lock(mtx_task);
+        for (auto& t : tasks) {
+            if (!(t.flag & CTX_VALID) || !t.poll_wait || t.state != CTS_WAIT)
+                continue;
+            for (auto& h : t.poll) {
+                if (h != -1 && handles[h].data.file == dec) {
+                    t.state = CTS_RUNNING;
+                    poll_unqueue(t.id);
+                    break;
+                }
+            }
+        }
+    }
+
+    bool cvm::poll_ready(const context_t * c, int h) const {
+        if (h == -1) { // 标准输入
+            if (c->input_redirect != -1)
+                return !c->input_queue.empty() || c->input_stop;
+            return global_state.input_lock == c->id && global_state.input_success;
+        }
+        return handles[h].data.file->index() != WAIT_CHAR;
+    }
+
+    // 与INTR 10相同：poll标准输入时获取输入锁，被占用时排队等待释放
+    void cvm::poll_input() {
+        if (ctx->input_redirect != -1 || global_state.input_lock == ctx->id)
+            return;
+        if (global_state.input_lock == -1) {
+            global_state.input_lock = ctx->id;
+            ctx->poll_lock = true;
+            host->input_set(true);
+        }
+        else {
+            auto& list = global_state.input_waiting_list;
+            if (std::find(list.begin(), list.end(), ctx->id) == list.end())
+                list.push_back(ctx->id);
+        }
+    }
+
+    // 标准输入未就绪时交还poll获取的输入锁，否则进程持锁期间无法输出
+    void cvm::poll_release() {
+        if (ctx->poll_lock && global_state.input_lock == ctx->id && !global_state.input_success) {
+            for (auto& _id : global_state.input_waiting_list) {
+                if (tasks[_id].flag & CTX_VALID) {
+                    assert(tasks[_id].state == CTS_WAIT);
+                    tasks[_id].state = CTS_RUNNING;
+                }
+            }
+            global_state.input_lock = -1;
+            global_state.input_waiting_list.clear();
+            global_state.input_read_ptr = -1;
+            global_state.input_content.clear();
+            host->input_set(false);
+        }
+        ctx->poll_lock = false;
+    }
+
+    // poll结束前不再等待输入锁，避免释放锁时唤醒已离开poll的进程
+    void cvm::poll_unqueue(int id) {
+        auto& list = global_state.input_waiting_list;
+        list.erase(std::remove(list.begin(), list.end(), id), list.end());
+    }
+
+    // 唤醒超时或标准输入就绪的poll进程，网络流由stream_ready唤醒
+    void cvm::poll_wakeup() {
+        auto now = std::chrono::system_clock::now();
+        for (auto& t : tasks) {
+            if (!(t.flag & CTX_VALID) || !t.poll_wait || t.state != CTS_WAIT)
+                continue;
+            if (now >= t.poll_deadline ||
+                std::any_of(t.poll.begin(), t.poll.end(), [&](int h) { return h == -1 && poll_ready(&t, h); })) {
+                t.state = CTS_RUNNING;
+                poll_unqueue(t.id);
+            }
+        }
+    }
+
     const char* cvm::state_string(cvm::ctx_state_t type) {
         assert(type >= CTS_RUNNING && type < CTS_DEAD);
         switch (type) {
@@ -1660,23 +2136,7 @@ namespace clib {
                 ctx = &tasks[j];
                 pids = (j + 1) % TASK_NUM;
                 ctx->id = j;
-                {
-                    std::stringstream ss;
-                    ss << "/proc/" << j;
-                    auto dir = ss.str();
-                    fs.as_root(true);
-                    if (fs.mkdir(dir) == 0) { // '/proc/[pid]'
-                        static std::vector<string_t> ps =
-                        { "exe", "parent", "heap_size" };
-                        dir += "/";
-                        for (auto& _ps : ps) {
-                            ss.str("");
-                            ss << dir << _ps;
-                            fs.func(ss.str(), this);
-                        }
-                    }
-                    fs.as_root(false);
-                }
+                proc_version++;
                 return j;
             }
         }
@@ -1685,6 +2145,7 @@ namespace clib {
     }
 
     int cvm::new_handle(cvm::handle_type type) {
+        std::lock_guard<std::mutex> lock(mtx_handle);
         if (available_handles >= HANDLE_NUM)
             error("max handle num!");
         auto end = HANDLE_NUM + handle_ids;
@@ -1705,6 +2166,7 @@ namespace clib {
     void cvm::destroy_handle(int handle) {
         if (handle < 0 || handle >= HANDLE_NUM)
             error("invalid handle");
+        std::lock_guard<std::mutex> lock(mtx_handle);
         if (handles[handle].type != h_none) {
             auto h = &handles[handle];
             if (h->type == h_file) {
@@ -1719,8 +2181,8 @@ namespace clib {
         }
     }
 
-    char* cvm::output_fmt(int id) const {
-        static char str[256];
+    string_t cvm::output_fmt(int id) const {
+        char str[256];
         switch (id) {
         case 1:
             sprintf(str, "%d", ctx->ax._i);
@@ -1754,16 +2216,16 @@ namespace clib {
             }
             else {
                 auto s = output_fmt(id);
-                while (*s) tasks[ctx->output_redirect].input_queue.push_back(*s++);
+                for (auto& c : s) tasks[ctx->output_redirect].input_queue.push_back(c);
             }
         }
         else if (global_state.input_lock == -1) {
             if (id == 0) {
-                cgui::singleton().put_char(ctx->ax._c);
+                host->put_char(ctx->ax._c);
             }
             else {
                 auto s = output_fmt(id);
-                while (*s) cgui::singleton().put_char(*s++);
+                for (auto& c : s) host->put_char(c);
             }
         }
         else {
@@ -1777,7 +2239,7 @@ namespace clib {
     }
 
     void cvm::cast() {
-        switch (vmm_get(ctx->pc)) {
+        switch (fetch()) {
         case 1:
             ctx->ax._ui = (uint)ctx->ax._i;
             break;
@@ -1898,9 +2360,16 @@ namespace clib {
     }
 
     bool cvm::interrupt() {
-        auto id = vmm_get(ctx->pc);
+        auto id = fetch();
         if (id > 200 && id < 300)
             return math(id);
+        // 按系统调用涉及的内核结构加锁（fs -> task）
+        std::unique_lock<std::recursive_mutex> lock_fs(mtx_fs, std::defer_lock);
+        std::unique_lock<std::recursive_mutex> lock_task(mtx_task, std::defer_lock);
+        if ((id >= 60 && id < 100) || id == 40 || id == 51 || id == 53 || id == 55 || id == 57)
+            lock_fs.lock();
+        if ((id < 60 && id != 30 && id != 31) || id == 71)
+            lock_task.lock();
         switch (id) {
         case 0:
         case 1:
@@ -1919,7 +2388,7 @@ namespace clib {
             break;
         case 8:
             if (global_state.input_lock == ctx->id) {
-                cgui::singleton().input_char(ctx->ax._c);
+                host->input_char(ctx->ax._c);
             }
             break;
         case 10: {
@@ -1931,7 +2400,7 @@ namespace clib {
                 if (global_state.input_lock == -1) {
                     global_state.input_lock = ctx->id;
                     ctx->pc += INC_PTR;
-                    cgui::singleton().input_set(true);
+                    host->input_set(true);
                 }
                 else {
                     global_state.input_waiting_list.push_back(ctx->id);
@@ -1973,7 +2442,7 @@ namespace clib {
                         global_state.input_read_ptr = -1;
                         global_state.input_content.clear();
                         global_state.input_success = false;
-                        cgui::singleton().input_set(false);
+                        host->input_set(false);
                         return true;
                     }
                     else {
@@ -2005,7 +2474,7 @@ namespace clib {
                     global_state.input_read_ptr = -1;
                     global_state.input_content.clear();
                     global_state.input_success = false;
-                    cgui::singleton().input_set(false);
+                    host->input_set(false);
                 }
             }
             else {
@@ -2048,7 +2517,7 @@ namespace clib {
                         global_state.input_read_ptr = -1;
                         global_state.input_content.clear();
                         global_state.input_success = false;
-                        cgui::singleton().input_set(false);
+                        host->input_set(false);
                         return true;
                     }
                     else {
@@ -2071,7 +2540,7 @@ namespace clib {
         case 20: {
             if (global_state.input_lock == -1) {
                 set_resize_id = ctx->id;
-                cgui::singleton().resize(ctx->ax._i >> 16, ctx->ax._i & 0xFFFF);
+                host->resize(ctx->ax._i >> 16, ctx->ax._i & 0xFFFF);
             }
             else {
                 if (global_state.input_lock != ctx->id)
@@ -2092,10 +2561,16 @@ namespace clib {
         case 40:
             destroy(ctx->id);
             return true;
-        case 51:
-            ctx->ax._i = exec_file(vmm_getstr((uint32_t)ctx->ax._i));
+        case 51: {
+            auto pid = exec_file(vmm_getstr((uint32_t)ctx->ax._i));
+            if (pid == VM_COMPILE_PENDING) { // 保留ax中的命令，重新执行本条中断
+                ctx->pc -= INC_PTR;
+                return true;
+            }
+            ctx->ax._i = pid;
             ctx->pc += INC_PTR;
             return true;
+        }
         case 50:
             ctx->ax._i = ctx->id;
             break;
@@ -2111,7 +2586,12 @@ namespace clib {
         }
                  break;
         case 53: {
-            ctx->ax._i = exec_file(vmm_getstr((uint32_t)ctx->ax._i));
+            auto pid = exec_file(vmm_getstr((uint32_t)ctx->ax._i));
+            if (pid == VM_COMPILE_PENDING) {
+                ctx->pc -= INC_PTR;
+                return true;
+            }
+            ctx->ax._i = pid;
             if (ctx->ax._i >= 0 && ctx->ax._i < TASK_NUM)
                 tasks[ctx->ax._i].state = CTS_WAIT;
             break;
@@ -2161,7 +2641,7 @@ namespace clib {
             else {
                 set_cycle_id = -1;
             }
-            cgui::singleton().set_cycle(ctx->ax._i);
+            host->set_cycle(ctx->ax._i);
             break;
         }
         case 60:
@@ -2248,6 +2728,48 @@ namespace clib {
             }
         }
                  break;
+        case 71: {
+            // poll，ax指向{handles, n, timeout}，返回首个就绪句柄的下标，超时返回-1
+            auto args = (uint32_t)ctx->ax._i;
+            auto hs = (uint32_t)vmm_get(args);
+            auto n = vmm_get(args + 4);
+            auto timeout = vmm_get(args + 8);
+            auto now = std::chrono::system_clock::now();
+            if (!ctx->poll_wait) {
+                ctx->poll_deadline = timeout < 0 ?
+                    (std::chrono::system_clock::time_point::max)() :
+                    now + std::chrono::milliseconds(timeout);
+            }
+            ctx->poll.clear();
+            auto ready = -1;
+            for (auto i = 0; i < n; ++i) {
+                auto h = vmm_get(hs + i * 4);
+                if (h != -1 && ctx->handles.find(h) == ctx->handles.end()) {
+                    ready = -2;
+                    break;
+                }
+                if (h == -1)
+                    poll_input();
+                if (poll_ready(ctx, h)) {
+                    ready = i;
+                    break;
+                }
+                ctx->poll.push_back(h);
+            }
+            if (ready == -1 && now < ctx->poll_deadline) {
+                // 挂起，就绪或超时后被唤醒，重新执行本条中断
+                ctx->poll_wait = true;
+                ctx->state = CTS_WAIT;
+                ctx->pc -= INC_PTR;
+                return true;
+            }
+            ctx->poll_wait = false;
+            ctx->poll.clear();
+            poll_unqueue(ctx->id);
+            poll_release();
+            ctx->ax._i = ready;
+        }
+                 break;
         case 100: {
             if (ctx->ax._i < 0) {
                 ctx->waiting_ms += (-ctx->ax._i) * 0.001;
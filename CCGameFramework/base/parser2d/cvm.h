@@ -12,6 +12,12 @@
 #include <chrono>
 #include <array>
 #include <deque>
+#include <random>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "types.h"
 #include "memory.h"
 #include "cmem.h"
@@ -93,10 +99,28 @@ namespace clib {
 #define TASK_NUM 256
 #define HANDLE_NUM 1024
 #define BIG_DATA_NUM 512
+#define SMP_MAX_WORKERS 64
+#define VM_COMPILE_PENDING (-3) // 宿主仍在后台编译，exec让出后重试
+#define VM_MOUNT_USR 1 // 挂载宿主的/usr目录，不再启动时预读
+
+    // 宿主服务：终端输入输出、编译等，由宿主（如cgui）实现并注入虚拟机
+    class vm_host_t {
+    public:
+        virtual ~vm_host_t() = default;
+        virtual void put_char(char c) = 0;
+        virtual void input_char(char c) = 0;
+        virtual void input_set(bool valid) = 0;
+        virtual void reset_cmd() = 0;
+        virtual void set_cycle(int cycle) = 0;
+        virtual void resize(int rows, int cols) = 0;
+        // 返回新进程号；失败返回负数，尚未编译完成时返回VM_COMPILE_PENDING
+        virtual int compile(const string_t& path, const std::vector<string_t>& args) = 0;
+        virtual string_t compile_report() = 0;
+    };
 
     class cvm : public imem, public vfs_func_t, public vfs_stream_call {
     public:
-        cvm();
+        explicit cvm(vm_host_t* host);
         ~cvm();
 
         cvm(const cvm&) = delete;
@@ -104,6 +128,7 @@ namespace clib {
 
         int load(const string_t& path, const std::vector<byte>& file, const std::vector<string_t>& args);
         bool run(int cycle, int& cycles);
+        void set_smp(int workers);
 
         void map_page(uint32_t addr, uint32_t id) override;
         void as_root(bool flag);
@@ -111,10 +136,13 @@ namespace clib {
         bool write_vfs(const string_t& path, const std::vector<byte>& data);
 
         vfs_stream_t stream_type(const string_t& path) const override;
-        string_t stream_callback(const string_t& path) override;
+        vfs_snapshot stream_callback(const string_t& path) override;
         vfs_node_dec* stream_create(const vfs_mod_query* mod, vfs_stream_t type, const string_t& path) override;
         int stream_index(vfs_stream_t type) override;
         string_t stream_net(vfs_stream_t type, const string_t& path) override;
+        void stream_ready(vfs_node_dec* dec) override;
+        int stream_version(const string_t& path) override;
+        void stream_list(const string_t& path, std::vector<vfs_entry>& list) override;
 
     private:
         // 申请页框
@@ -144,18 +172,25 @@ namespace clib {
         T vmm_popstack(uint32_t & sp);
 
         void error(const string_t&) const;
+        bool verify(const std::vector<byte>& file) const;
+        int fetch() const;
         void exec(int cycle, int& cycles);
+        void run_serial(int cycle, int& cycles);
+        void run_smp(int cycle, int& cycles);
+        void smp_worker(int id);
+        void smp_stop();
         void destroy(int id);
         int exec_file(const string_t& path);
         int fork();
 
-        char* output_fmt(int id) const;
+        string_t output_fmt(int id) const;
         int output(int id);
         bool interrupt();
         bool math(int id);
         void cast();
 
         void init_fs();
+        string_t stream_text(const string_t& path);
 
         enum handle_type {
             h_none,
@@ -167,6 +202,7 @@ namespace clib {
         void destroy_handle(int handle);
 
     private:
+        vm_host_t* host{ nullptr };
         /* 内核页表 = PTE_SIZE*PAGE_SIZE */
         pde_t* pgd_kern{ nullptr };
         /* 内核页表内容 = PTE_COUNT*PTE_SIZE*PAGE_SIZE */
@@ -227,6 +263,9 @@ namespace clib {
             uint sp{ 0 };
             bool debug{ false };
             std::vector<byte> file;
+            // 校验通过的代码段，取指不经过页表
+            const int* code{ nullptr };
+            uint code_len{ 0 };
             std::vector<uint32_t> allocation;
             std::vector<uint32_t> data_mem;
             std::vector<uint32_t> text_mem;
@@ -240,8 +279,19 @@ namespace clib {
             bool input_stop{ false };
             std::deque<char> input_queue;
             std::unordered_set<int> handles;
+            // poll挂起时等待的句柄，-1为标准输入
+            bool poll_wait{ false };
+            bool poll_lock{ false }; // 输入锁由poll获取
+            std::vector<int> poll;
+            std::chrono::system_clock::time_point poll_deadline;
+        };
+        // 当前CPU上运行的进程，SMP模式下每个工作线程各有一份
+        static thread_local context_t* ctx;
+        // 离开作用域时恢复ctx，出错返回时也不会留下指向本实例的指针
+        struct ctx_scope {
+            context_t* old{ ctx };
+            ~ctx_scope() { ctx = old; }
         };
-        context_t* ctx{ nullptr };
         int available_tasks{ 0 };
         std::array<context_t, TASK_NUM> tasks;
         cvfs fs;
@@ -259,9 +309,51 @@ namespace clib {
         int set_cycle_id{ -1 };
         int set_resize_id{ -1 };
         std::array<handle_t, HANDLE_NUM> handles;
+        std::default_random_engine random_engine;
+        // /proc随进程创建和销毁换代，/sys/ps按进程表内容缓存快照
+        int proc_version{ 0 };
+        using ps_key_t = std::vector<std::tuple<int, int, int, string_t>>; // pid, state, parent, path
+        ps_key_t ps_key;
+        size_t ps_alloc{ 0 };
+        vfs_snapshot ps_snapshot;
+
+        bool poll_ready(const context_t* c, int h) const;
+        void poll_input();
+        void poll_release();
+        void poll_unqueue(int id);
+        void poll_wakeup();
+
+        // 内核锁，加锁顺序：fs -> task -> handle -> mem
+        // 宿主服务只在持有task锁时调用
+        std::recursive_mutex mtx_fs;
+        std::recursive_mutex mtx_task;
+        std::mutex mtx_handle;
+        std::mutex mtx_mem;
+
+        // SMP：每个工作线程一个运行队列，空闲时从其他队列尾部窃取
+        struct run_queue_t {
+            std::mutex lock;
+            std::deque<context_t*> queue;
+        };
+        context_t* smp_next(int id);
+        std::vector<std::thread> smp_workers;
+        std::vector<std::unique_ptr<run_queue_t>> smp_queues;
+        std::mutex smp_lock;
+        std::condition_variable smp_start;
+        std::condition_variable smp_done;
+        int smp_round{ 0 };
+        int smp_pending{ 0 };
+        int smp_cycle{ 0 };
+        bool smp_exit{ false };
+        bool smp_active{ false };
+        std::atomic<int> smp_cycles{ 0 };
+        std::atomic<bool> smp_failed{ false };
+        std::exception_ptr smp_error;
+        std::array<bool, TASK_NUM> smp_scheduled{};
+        std::vector<int> smp_kill;
 
     public:
-        static struct global_state_t {
+        struct global_state_t {
             bool interrupt{ false };
             int input_lock{ -1 };
             std::vector<int> input_waiting_list;
@@ -8,6 +8,8 @@
 
 #include <cassert>
 #include <sstream>
+#include <vector>
+#include <new>
 #include "types.h"
 
 namespace clib {
@@ -460,6 +462,94 @@ namespace clib {
 
     template<size_t DefaultSize = default_allocator<>::DEFAULT_ALLOC_BLOCK_SIZE>
     using memory_pool = legacy_memory_pool<legacy_memory_pool_allocator<default_allocator<>, DefaultSize>>;
+
+    // 分块线性分配区，只增不减，不单独释放，整体清空或回退到标记处
+    template<size_t ChunkSize = 0x10000>
+    class memory_arena {
+    public:
+        struct mark_t {
+            size_t chunk;
+            size_t offset;
+        };
+
+        memory_arena() = default;
+        ~memory_arena() {
+            for (auto& c : chunks)
+                delete[] c.data;
+        }
+
+        memory_arena(const memory_arena&) = delete;
+        memory_arena& operator=(const memory_arena&) = delete;
+
+        void* alloc(size_t size, size_t align = sizeof(void*)) {
+            for (;;) {
+                if (current < chunks.size()) {
+                    auto& c = chunks[current];
+                    auto p = (offset + align - 1) & ~(align - 1);
+                    if (p + size <= c.size) {
+                        offset = p + size;
+                        return c.data + p;
+                    }
+                    if (++current < chunks.size()) { // 复用回退后留下的块
+                        offset = 0;
+                        continue;
+                    }
+                }
+                auto n = size > ChunkSize ? size : ChunkSize;
+                chunks.push_back({ new char[n], n });
+                current = chunks.size() - 1;
+                offset = 0;
+            }
+        }
+
+        template<class T>
+        T* alloc() {
+            return new(alloc(sizeof(T), alignof(T))) T();
+        }
+
+        template<class T>
+        T* alloc_array(size_t count) {
+            return (T*)alloc(sizeof(T) * count, alignof(T));
+        }
+
+        mark_t mark() const {
+            return { current, offset };
+        }
+
+        void rewind(const mark_t& m) {
+            assert(m.chunk <= current);
+            current = m.chunk;
+            offset = m.offset;
+        }
+
+        void clear() {
+            current = 0;
+            offset = 0;
+        }
+
+        size_t capacity() const {
+            size_t n = 0;
+            for (auto& c : chunks)
+                n += c.size;
+            return n;
+        }
+
+        size_t used() const {
+            size_t n = 0;
+            for (size_t i = 0; i < current && i < chunks.size(); ++i)
+                n += chunks[i].size;
+            return n + offset;
+        }
+
+    private:
+        struct chunk_t {
+            char* data;
+            size_t size;
+        };
+        std::vector<chunk_t> chunks;
+        size_t current{ 0 };
+        size_t offset{ 0 };
+    };
 }
 
 #endif //QLIB2D_MEMORY_H
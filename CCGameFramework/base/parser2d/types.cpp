@@ -260,7 +260,7 @@ namespace clib {
     };
 
     const string_t& coll_str(coll_t t) {
-        assert(t >= c_program && t <= c_declarationList);
+        assert(t >= c_program && t < c__end);
         return std::get<1>(coll_string_list[t]);
     }
 
@@ -272,6 +272,9 @@ namespace clib {
         std::make_tuple(JMP, "JMP"),
         std::make_tuple(JZ, "JZ"),
         std::make_tuple(JNZ, "JNZ"),
+        std::make_tuple(JTAB, "JTAB"),
+        std::make_tuple(JMAP, "JMAP"),
+        std::make_tuple(TAIL, "TAIL"),
         std::make_tuple(ENT, "ENT"),
         std::make_tuple(LOAD, "LOAD"),
         std::make_tuple(SAVE, "SAVE"),
@@ -280,6 +283,7 @@ namespace clib {
         std::make_tuple(ADJ, "ADJ"),
         std::make_tuple(CALL, "CALL"),
         std::make_tuple(LEV, "LEV"),
+        std::make_tuple(RET, "RET"),
         std::make_tuple(PUSH, "PUSH"),
         std::make_tuple(POP, "POP"),
         std::make_tuple(OR, "OR"),
@@ -309,4 +313,20 @@ namespace clib {
         assert(t >= NOP && t <= EXIT);
         return std::get<1>(ins_string_list[t]);
     }
+
+    int ins_size(ins_t t) { // 指令字数，含操作码
+        switch (t) {
+        case NOP:
+        case CALL:
+        case LEV:
+        case RET:
+        case CASE:
+        case EXIT:
+            return 1;
+        case IMX:
+            return 3;
+        default:
+            return 2;
+        }
+    }
 }
@@ -167,7 +167,7 @@ namespace clib {
     };
 
     enum ins_t {
-        NOP, LEA, IMM, IMX, JMP, JZ, JNZ, ENT, LOAD, SAVE, INTR, CAST, ADJ, CALL, LEV,
+        NOP, LEA, IMM, IMX, JMP, JZ, JNZ, JTAB, JMAP, TAIL, ENT, LOAD, SAVE, INTR, CAST, ADJ, CALL, LEV, RET,
         PUSH, POP, OR, XOR, AND, EQ, CASE, NE, LT, GT, LE, GE, SHL, SHR, ADD, SUB, MUL, DIV, MOD, NEG, NOT, LNT,
         EXIT,
     };
@@ -257,6 +257,8 @@ struct base_lexer_t<obj> \
 
     const string_t& ins_str(ins_t);
 #define INS_STRING(t) ins_str(t)
+    int ins_size(ins_t);
+#define INS_SIZE(t) ins_size(t)
 
     enum coll_t {
         c_program,
@@ -336,6 +338,7 @@ struct base_lexer_t<obj> \
         c_externalDeclaration,
         c_functionDefinition,
         c_declarationList,
+        c__end
     };
 
     const string_t& coll_str(coll_t);
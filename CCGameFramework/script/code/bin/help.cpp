@@ -36,6 +36,8 @@ int main(int argc, char **argv) {
     put_string("    test_struct     - test struct and linked list\n");
     put_string("    test_xtoa       - test itoa/dtoa/atoi\n");
     put_string("    test_vector     - test vector\n");
+    put_string("    test_tail       - test tail call\n");
+    put_string("    test_poll       - test poll on stdin\n");
     put_string("    draw            - test draw function\n");
     put_string("    badapple        - test badapple animation\n");
     restore_fg();
@@ -48,4 +48,19 @@ int write(int handle, char c) {
 int truncate(int handle) {
     handle;
     interrupt 70;
+}
+struct __poll_args__ {
+    int *handles;
+    int n;
+    int timeout;
+};
+// 等待任一句柄可读（-1为标准输入），timeout单位为毫秒，小于0则一直等待
+// 返回就绪句柄的下标，超时返回-1，句柄无效返回-2
+int poll(int *handles, int n, int timeout) {
+    __poll_args__ args;
+    args.handles = handles;
+    args.n = n;
+    args.timeout = timeout;
+    &args;
+    interrupt 71;
 }
\ No newline at end of file
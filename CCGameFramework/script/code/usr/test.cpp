@@ -14,6 +14,8 @@ int main(int argc, char **argv) {
         case 6: shell("/usr/test_struct");
         case 7: shell("/usr/test_xtoa");
         case 8: shell("/usr/test_vector");
+        case 9: shell("/usr/test_tail");
+        case 10: shell("/usr/test_poll");
     }
     return 0;
 }
\ No newline at end of file
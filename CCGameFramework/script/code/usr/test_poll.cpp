@@ -0,0 +1,29 @@
+#include "/include/io"
+#include "/include/fs"
+#include "/include/memory"
+#include "/include/string"
+int main(int argc, char **argv) {
+    int *hs = (int *) malloc(4);
+    char *text = malloc(100);
+    int i, c, r;
+    put_string("========== [#10 TEST POLL] ==========\n");
+    put_string("Input in 5s: ");
+    hs[0] = -1; // 标准输入
+    r = poll(hs, 1, 5000);
+    if (r == 0) {
+        for (i = 0; i < 99 && (c = input_char()) != -1; ++i)
+            text[i] = c;
+        text[i] = '\0';
+        put_string("Output: ");
+        put_string(text);
+        put_string("\n");
+        put_string("Length: ");
+        put_int(strlen(text));
+        put_string("\n");
+    }
+    else {
+        put_string("Timeout\n");
+    }
+    put_string("========== [#10 TEST POLL] ==========\n");
+    return 0;
+}
\ No newline at end of file
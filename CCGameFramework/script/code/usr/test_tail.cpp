@@ -0,0 +1,42 @@
+#include "/include/io"
+// 尾调用：递归在尾部时复用栈帧
+int count(int n, int acc) {
+    if (n == 0)
+        return acc;
+    return count(n - 1, acc + 1);
+}
+int gcd(int a, int b) {
+    if (b == 0)
+        return a;
+    return gcd(b, a % b);
+}
+// 结构体局部变量在栈帧内，不做尾调用
+struct pair {
+    int a;
+    int b;
+};
+int add(pair p) {
+    int k[4];
+    k[0] = p.a; k[1] = p.b;
+    return k[0] + k[1];
+}
+int twice(pair p) {
+    pair q;
+    q.a = p.a * 2;
+    q.b = p.b * 2;
+    return add(q);
+}
+int pick(pair p) {
+    return count(p.a, p.b);
+}
+int main(int argc, char **argv) {
+    pair p;
+    put_string("========== [#9 TEST TAIL] ==========\n");
+    put_string("count(100000): "); put_int(count(100000, 0)); put_string("\n");
+    put_string("gcd(1071,462): "); put_int(gcd(1071, 462)); put_string("\n");
+    p.a = 3; p.b = 4;
+    put_string("twice(3, 4):   "); put_int(twice(p)); put_string("\n");
+    put_string("pick(3, 4):    "); put_int(pick(p)); put_string("\n");
+    put_string("========== [#9 TEST TAIL] ==========\n");
+    return 0;
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "WindowMsgLoop.h"
+#include <base/http.h>
 
 void Msg_Init(WindowMsgLoop::MSGMAP& msgMap);
 
@@ -29,6 +30,7 @@ void WindowMsgLoop::Run()
     WSADATA wsaData;
     wVersionRequested = MAKEWORD(2, 2);
     WSAStartup(wVersionRequested, &wsaData);
+    http_engine::singleton().start(evbase);
 
     struct timeval tv;
     evtimer_assign(&msgtimer, evbase, &msg_timer, this);
@@ -38,6 +40,7 @@ void WindowMsgLoop::Run()
     evtimer_add(&msgtimer, &tv);
     event_base_dispatch(evbase);
 
+    http_engine::singleton().stop();
     WSACleanup();
 }
 